@@ -1,20 +1,42 @@
 #include "Commands.h"
+#include "dag.h"
+#include "repeat.h"
+#include "signals.h"
+#include "trace.h"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits.h>
+#include <map>
+#include <poll.h>
 #include <sstream>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <vector>
 
 const std::string WHITESPACE = " \n\r\t\f\v";
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open (434)
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal (424)
+#endif
+
 #if 0
 #define FUNC_ENTRY() cout << __PRETTY_FUNCTION__ << " --> " << std::endl;
 
@@ -48,7 +70,8 @@ int _parseCommandLine(const std::string &cmd_line, char **args) {
   FUNC_ENTRY()
   int i = 0;
   std::istringstream iss(_trim(cmd_line).c_str());
-  for (std::string s; iss >> s;) {
+  // Words past what argv holds are dropped.
+  for (std::string s; i < MAX_ARGV_LENGTH - 1 && iss >> s;) {
     args[i] = (char *)malloc(s.length() + 1);
     memset(args[i], 0, s.length() + 1);
     strcpy(args[i], s.c_str());
@@ -64,6 +87,30 @@ bool _isBackgroundComamnd(const char *cmd_line) {
   return str[str.find_last_not_of(WHITESPACE)] == '&';
 }
 
+// Returns the index of the pipe operator in cmd_line, skipping ">|" and
+// the word of a here-string, which may be quoted and hold a |.
+size_t _findPipe(const std::string &cmd_line) {
+  for (size_t i = 0; i < cmd_line.length(); i++) {
+    if (cmd_line.compare(i, 3, "<<<") == 0) {
+      size_t word = cmd_line.find_first_not_of(WHITESPACE, i + 3);
+      if (word == std::string::npos) {
+        break;
+      }
+      char quote = cmd_line[word];
+      size_t end = quote == '"' || quote == '\''
+                       ? cmd_line.find(quote, word + 1)
+                       : std::string::npos;
+      // Without its closing quote the word is read as it is.
+      i = end != std::string::npos ? end : word - 1;
+      continue;
+    }
+    if (cmd_line[i] == '|' && (i == 0 || cmd_line[i - 1] != '>')) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
 void _removeBackgroundSign(char *cmd_line) {
   const std::string str(cmd_line);
   // find last character other than spaces
@@ -83,7 +130,35 @@ void _removeBackgroundSign(char *cmd_line) {
   cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
 }
 
-static void syscallError(const std::string &syscall) {
+static int _pidfdOpen(pid_t pid) {
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+static uint64_t _monotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static long _monotonicMillis() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int exitStatus(int waitStatus) {
+  if (WIFSIGNALED(waitStatus)) {
+    return 128 + WTERMSIG(waitStatus);
+  }
+  if (WIFSTOPPED(waitStatus)) {
+    return 128 + WSTOPSIG(waitStatus);
+  }
+  return WEXITSTATUS(waitStatus);
+}
+
+void syscallError(const std::string &syscall) {
+  // perror bypasses std::cerr, so keep the buffered output ordered by hand.
+  std::cout.flush();
   std::string msg =
       std::string("smash error: " + syscall + std::string(" failed"));
   perror(msg.c_str());
@@ -93,31 +168,54 @@ static void syscallError(const std::string &syscall) {
 //------------------------Small Shell functions------------------------//
 //                                                                     //
 SmallShell::SmallShell()
-    : smash_pid(getpid()), current_display_prompt("smash"), last_dir(""),
-      default_display_prompt("smash"), is_working(true) {}
+    : default_display_prompt("smash"), smash_pid(getpid()),
+      current_display_prompt("smash"), last_dir(""), is_working(true),
+      path_index(reactor), output_buffer(STDOUT_FILENO),
+      original_output(std::cout.rdbuf(&output_buffer)),
+      parse_cache(LRU_CACHE_DEFAULT_SIZE) {
+  // Started first, the helper is forked while the shell is still small.
+  const char *forkServer = getenv("SMASH_FORK_SERVER");
+  if (forkServer && std::string(forkServer) == "1") {
+    fork_server.start();
+  }
+  // Listed in the background, the prompt does not wait for it.
+  const std::string *searchPath = environment.get("PATH");
+  path_index.update(searchPath ? *searchPath : "");
+  const char *path = getenv("SMASH_HISTORY");
+  const char *home = getenv("HOME");
+  if (path) {
+    history.open(path);
+  } else if (home) {
+    history.open(std::string(home) + "/" + HISTORY_FILE_NAME);
+  }
+  jobs.getTable()->open(smash_pid);
+  jobs.setReactor(&reactor);
+  reactor.add(getSignalEventFd(), EPOLLIN,
+              [this](uint32_t) { processSignalEvents(); });
+}
 
 // TODO: add your implementation
 
 SmallShell::~SmallShell() {
-  // TODO: add your implementation
+  std::cout.flush();
+  std::cout.rdbuf(original_output);
 }
 
 SmallShell::CommandType
 SmallShell::checkType(const std::string &cmd_line) const {
-  if (std::string(cmd_line).find(">") != std::string::npos) {
-    if (std::string(cmd_line).find(">>") != std::string::npos) {
-      return CommandType::RedirectAppend;
-    }
-    return CommandType::Redirect;
-  }
-
-  if (std::string(cmd_line).find("|") != std::string::npos) {
-    if (std::string(cmd_line).find("|&") != std::string::npos) {
+  // Each side of a pipe may carry its own redirections, so pipes come first.
+  size_t pipeIndex = _findPipe(cmd_line);
+  if (pipeIndex != std::string::npos) {
+    if (cmd_line.compare(pipeIndex, 2, "|&") == 0) {
       return CommandType::PipeErr;
     }
     return CommandType::Pipe;
   }
 
+  if (std::string(cmd_line).find_first_of("<>") != std::string::npos) {
+    return CommandType::Redirect;
+  }
+
   return CommandType::Regular;
 }
 
@@ -136,81 +234,381 @@ std::string SmallShell::getDisplayPrompt() const {
 }
 bool SmallShell::isSmashWorking() const { return is_working; }
 void SmallShell::disableSmash() { is_working = false; }
-void SmallShell::killAllJobs() { jobs.killAllJobs(); }
+void SmallShell::killAllJobs(int graceMs) { jobs.killAllJobs(graceMs); }
 JobsList *SmallShell::getJobList() { return &jobs; }
+Reactor *SmallShell::getReactor() { return &reactor; }
+
+/**
+ * The index of PATH as it is now. Waits for its directories to be listed,
+ * unless ctrl-C or ctrl-Z comes first.
+ */
+PathIndex *SmallShell::getPathIndex() {
+  const std::string *searchPath = environment.get("PATH");
+  path_index.update(searchPath ? *searchPath : "");
+  unsigned long before = interrupts;
+  runEvents(
+      [&]() { return path_index.isReady() || interrupts != before; });
+  return &path_index;
+}
+
+unsigned long SmallShell::getInterrupts() const { return interrupts; }
+LruCache<SmallShell::ParsedLine> *SmallShell::getParseCache() {
+  return &parse_cache;
+}
+History *SmallShell::getHistory() { return &history; }
+Environment *SmallShell::getEnvironment() { return &environment; }
 Command *SmallShell::getCurrentCommand() const { return current_command; }
 pid_t SmallShell::getCurrentCommandPid() const { return current_command_pid; }
 
-void SmallShell::setCurrentCommandPid(pid_t pid) { current_command_pid = pid; }
+void SmallShell::setCurrentCommandPid(pid_t pid) {
+  current_command_pid = pid;
+  setForegroundPid(pid);
+}
 void SmallShell::setCurrentCommand(Command *command) {
   current_command = command;
 }
 
-void SmallShell::stopCurrentCommand() {
-  std::cout << "smash: got ctrl-Z" << std::endl;
+/**
+ * Acts on the signals received since the last call. The handler already
+ * forwarded ctrl-C/ctrl-Z, so all that is left is reporting them. Returns
+ * whether one of them was ctrl-C or ctrl-Z, which interrupt waits.
+ */
+bool SmallShell::processSignalEvents() {
+  // Emptied first, an event pushed after this still leaves a wakeup behind.
+  clearSignalEvents();
+
+  bool interrupted = false;
+  SignalEvent event;
+  while (popSignalEvent(&event)) {
+    switch (event.signo) {
+    case SIGTSTP:
+      std::cout << "smash: got ctrl-Z" << '\n';
+      interrupted = true;
+      break;
+    case SIGINT:
+      std::cout << "smash: got ctrl-C" << '\n';
+      if (event.pid != -1) {
+        std::cout << "smash: process " << event.pid << " was killed" << '\n';
+      }
+      interrupted = true;
+      break;
+    case SIGALRM:
+      handleAlarm(event.pid);
+      break;
+    }
+  }
+  std::cout.flush();
+  signal_rounds++;
+  if (interrupted) {
+    interrupts++;
+  }
+  return interrupted;
+}
+
+void SmallShell::handleAlarm(pid_t pid) {
+  std::cout << "smash: got an alarm" << '\n';
 
-  if (current_command_pid == -1) {
-    return;
+  std::string command_line;
+  if (current_command_pid != -1 && current_command_pid == pid) {
+    command_line = current_command->getCommandLine();
+  } else {
+    auto job = jobs.getJobByPid(pid);
+    if (!job) {
+      return;
+    }
+    command_line = job->command_line;
   }
+  kill(pid, SIGKILL);
+  std::cout << "smash: " << command_line << " timed out!" << '\n';
+}
 
-  kill(current_command_pid, SIGSTOP);
+typedef std::shared_ptr<Command> (*BuiltinFactory)(
+    const std::string &cmd_line, const std::string &cmd_line_stripped);
+
+template <class T>
+static std::shared_ptr<Command>
+_makeBuiltin(const std::string &cmd_line,
+             const std::string &cmd_line_stripped) {
+  return std::make_shared<T>(cmd_line, cmd_line_stripped);
 }
 
-void SmallShell::killCurrentCommand() {
-  std::cout << "smash: got ctrl-C" << std::endl;
+template <class T>
+static std::shared_ptr<Command> _cloneCommand(const Command &command) {
+  return std::make_shared<T>(static_cast<const T &>(command));
+}
 
-  if (current_command_pid == -1) {
-    return;
+struct BuiltinEntry {
+  const char *name;
+  BuiltinFactory factory;
+  CommandCloner clone;
+};
+
+#define BUILTIN(name, T) {name, _makeBuiltin<T>, _cloneCommand<T>}
+
+// Every builtin is registered here and nowhere else. Keep it sorted by name,
+// it is binary searched and the static_assert below checks the order.
+static constexpr BuiltinEntry BUILTINS[] = {
+    BUILTIN("bg", BackgroundCommand),
+    BUILTIN("cache", CacheCommand),
+    BUILTIN("capture", CaptureCommand),
+    BUILTIN("cd", ChangeDirCommand),
+    BUILTIN("chprompt", ChangePromptCommand),
+    BUILTIN("dag", DagCommand),
+    BUILTIN("export", ExportCommand),
+    BUILTIN("fare", FareCommand),
+    BUILTIN("fg", ForegroundCommand),
+    BUILTIN("history", HistoryCommand),
+    BUILTIN("jobs", JobsCommand),
+    BUILTIN("kill", KillCommand),
+    BUILTIN("limit", LimitCommand),
+    BUILTIN("pwd", GetCurrDirCommand),
+    BUILTIN("quit", QuitCommand),
+    BUILTIN("repeat", RepeatCommand),
+    BUILTIN("setcore", SetcoreCommand),
+    BUILTIN("showpid", ShowPidCommand),
+    BUILTIN("sigstats", SigstatsCommand),
+    BUILTIN("trace", TraceCommand),
+    BUILTIN("type", TypeCommand),
+    BUILTIN("unset", UnsetCommand),
+    BUILTIN("wait", WaitCommand),
+    BUILTIN("which", WhichCommand),
+};
+static constexpr size_t BUILTINS_COUNT = sizeof(BUILTINS) / sizeof(*BUILTINS);
+
+static constexpr int _constexprCompare(const char *a, const char *b) {
+  return *a != *b || *a == '\0' ? (unsigned char)*a - (unsigned char)*b
+                                : _constexprCompare(a + 1, b + 1);
+}
+
+static constexpr bool _isSorted(const BuiltinEntry *table, size_t size) {
+  return size < 2 || (_constexprCompare(table[0].name, table[1].name) < 0 &&
+                      _isSorted(table + 1, size - 1));
+}
+
+static_assert(_isSorted(BUILTINS, BUILTINS_COUNT),
+              "BUILTINS must be sorted by name");
+
+static const BuiltinEntry *_findBuiltin(const std::string &name) {
+  auto end = BUILTINS + BUILTINS_COUNT;
+  auto it = std::lower_bound(BUILTINS, end, name,
+                             [](const BuiltinEntry &entry,
+                                const std::string &name) {
+                               return name.compare(entry.name) > 0;
+                             });
+  if (it == end || name.compare(it->name) != 0) {
+    return nullptr;
+  }
+  return it;
+}
+
+bool SmallShell::isBuiltin(const std::string &name) const {
+  return _findBuiltin(name) != nullptr;
+}
+
+/**
+ * What Tab offers for word. Commands are builtins and whatever the PATH
+ * index has so far, it is not waited for. Anything else, or a command with
+ * a / in it, is a file name, directories end with a /.
+ */
+std::vector<std::string> SmallShell::completeWord(const std::string &word,
+                                                  bool command) {
+  std::vector<std::string> matches;
+  if (command && word.find('/') == std::string::npos) {
+    for (auto &&builtin : BUILTINS) {
+      if (std::string(builtin.name).compare(0, word.length(), word) == 0) {
+        matches.push_back(builtin.name);
+      }
+    }
+    const std::string *searchPath = environment.get("PATH");
+    path_index.update(searchPath ? *searchPath : "");
+    std::vector<std::string> found = path_index.complete(word);
+    matches.insert(matches.end(), found.begin(), found.end());
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    return matches;
+  }
+
+  size_t slash = word.rfind('/');
+  std::string dir = slash == std::string::npos ? "" : word.substr(0, slash + 1);
+  std::string base = word.substr(dir.length());
+  DIR *listing = opendir(dir.empty() ? "." : dir.c_str());
+  if (!listing) {
+    return matches;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(listing))) {
+    std::string name = entry->d_name;
+    if (name == "." || name == ".." || (name[0] == '.' && base[0] != '.') ||
+        name.compare(0, base.length(), base) != 0) {
+      continue;
+    }
+    struct stat info;
+    if (stat((dir + name).c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+      name += '/';
+    }
+    matches.push_back(dir + name);
+  }
+  closedir(listing);
+  std::sort(matches.begin(), matches.end());
+  return matches;
+}
+
+/**
+ * Appends text split into words, the way bash splits an unquoted expansion:
+ * any run of whitespace becomes a single space. Returns the number of words.
+ */
+static int _appendWords(std::string &line, const std::string &text) {
+  int words = 0;
+  bool space = false;
+  for (char c : text) {
+    if (WHITESPACE.find(c) != std::string::npos) {
+      space = true;
+      continue;
+    }
+    line += space ? " " : "";
+    line += c;
+    words += space || words == 0 ? 1 : 0;
+    space = false;
+  }
+  line += space ? " " : "";
+  return words;
+}
+
+// An expansion stands in the line being parsed as its index between these,
+// which no operator, name or word is made of.
+static const char EXPANSION_START = '\x01';
+static const char EXPANSION_END = '\x02';
+
+static std::string _expansionPlaceholder(size_t index) {
+  return EXPANSION_START + std::to_string(index) + EXPANSION_END;
+}
+
+/**
+ * Like _appendWords, with every word in single quotes, so bash reads none
+ * of it as syntax.
+ */
+static void _appendQuotedWords(std::string &line, const std::string &text) {
+  std::string words;
+  _appendWords(words, text);
+  bool quoted = false;
+  for (char c : words) {
+    if (c == ' ') {
+      line += quoted ? "' " : " ";
+      quoted = false;
+      continue;
+    }
+    line += quoted ? "" : "'";
+    line += c == '\'' ? "'\\''" : std::string(1, c);
+    quoted = true;
+  }
+  line += quoted ? "'" : "";
+}
+
+enum class ExpansionUse { Text, Words, Quoted };
+
+/**
+ * Puts the values of expansions back in place of their placeholders. Text
+ * keeps a value as it is, for targets and here-documents, Words splits it
+ * like an unquoted expansion, and Quoted also quotes the words for bash.
+ */
+static std::string _substitute(const std::string &text,
+                               const Expansions *expansions,
+                               ExpansionUse use) {
+  if (!expansions || expansions->empty()) {
+    return text;
+  }
+  std::string out;
+  size_t position = 0;
+  size_t start;
+  while ((start = text.find(EXPANSION_START, position)) != std::string::npos) {
+    size_t end = text.find(EXPANSION_END, start);
+    if (end == std::string::npos) {
+      break;
+    }
+    out.append(text, position, start - position);
+    size_t index = strtoul(text.c_str() + start + 1, nullptr, 10);
+    std::string value = index < expansions->size() ? (*expansions)[index] : "";
+    if (use == ExpansionUse::Text) {
+      out += value;
+    } else if (use == ExpansionUse::Words) {
+      _appendWords(out, value);
+    } else {
+      _appendQuotedWords(out, value);
+    }
+    position = end + 1;
   }
+  out.append(text, position, std::string::npos);
+  return out;
+}
 
-  std::cout << "smash: process " << current_command_pid << " was killed"
-            << std::endl;
-  kill(current_command_pid, SIGKILL);
+static void _substitutePlan(RedirectionPlan &plan,
+                            const Expansions *expansions) {
+  for (auto &&action : plan) {
+    if (action.type != FdAction::Type::Dup) {
+      action.path = _substitute(action.path, expansions, ExpansionUse::Text);
+    }
+  }
 }
+
 /**
  * Creates and returns a pointer to Command class which matches the given
  * command line (cmd_line)
  */
-static std::shared_ptr<Command> CreateCommandImpl(const std::string &cmd_line,
-                                                  const std::string &original) {
-  // For example:
-
+static std::shared_ptr<Command>
+CreateCommandImpl(const std::string &cmd_line, const std::string &original,
+                  CommandCloner *outClone = nullptr,
+                  const Expansions *expansions = nullptr) {
   std::string cmd_s = _trim(cmd_line);
-  bool background_flag = cmd_s.back() == '&';
+  // Operators and assignments are only what was typed, expansions are
+  // put in their words after that.
+  bool background_flag = !cmd_s.empty() && cmd_s.back() == '&';
   if (background_flag) {
     cmd_s.pop_back();
   }
-  std::string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
 
-  /* check if special command I.E pipe*/
-
-  if (firstWord.compare("chprompt") == 0) {
-    return std::make_shared<ChangePromptCommand>(original, cmd_s);
-  } else if (firstWord.compare("showpid") == 0) {
-    return std::make_shared<ShowPidCommand>(original, cmd_s);
-  } else if (firstWord.compare("pwd") == 0) {
-    return std::make_shared<GetCurrDirCommand>(original, cmd_s);
-  } else if (firstWord.compare("cd") == 0) {
-    return std::make_shared<ChangeDirCommand>(original, cmd_s);
-  } else if (firstWord.compare("quit") == 0) {
-    return std::make_shared<QuitCommand>(original, cmd_s);
-  } else if (firstWord.compare("jobs") == 0) {
-    return std::make_shared<JobsCommand>(original, cmd_s);
-  } else if (firstWord.compare("fg") == 0) {
-    return std::make_shared<ForegroundCommand>(original, cmd_s);
-  } else if (firstWord.compare("kill") == 0) {
-    return std::make_shared<KillCommand>(original, cmd_s);
-  } else if (firstWord.compare("bg") == 0) {
-    return std::make_shared<BackgroundCommand>(original, cmd_s);
-  } else if (firstWord.compare("setcore") == 0) {
-    return std::make_shared<SetcoreCommand>(original, cmd_s);
-  } else if (firstWord.compare("fare") == 0) {
-    return std::make_shared<FareCommand>(original, cmd_s);
-  } else {
-    return std::make_shared<ExternalCommand>(original, cmd_s, background_flag);
+  // Leading NAME=value words are set for the command alone, or for the
+  // shell when nothing follows them.
+  std::vector<std::string> assignments;
+  size_t start = cmd_s.find_first_not_of(WHITESPACE);
+  while (start != std::string::npos) {
+    size_t end = cmd_s.find_first_of(WHITESPACE, start);
+    std::string word = cmd_s.substr(start, end - start);
+    if (!isAssignment(word)) {
+      break;
+    }
+    assignments.push_back(_substitute(word, expansions, ExpansionUse::Text));
+    start = cmd_s.find_first_not_of(WHITESPACE, end);
+  }
+  std::string display = _substitute(original, expansions, ExpansionUse::Words);
+  std::string text = start == std::string::npos ? "" : cmd_s.substr(start);
+  std::string words =
+      _trim(_substitute(text, expansions, ExpansionUse::Words));
+  // Also when the command expanded to nothing.
+  if (words.empty()) {
+    if (outClone) {
+      *outClone = _cloneCommand<AssignmentCommand>;
+    }
+    return std::make_shared<AssignmentCommand>(
+        display, _substitute(cmd_s.substr(0, start), expansions,
+                             ExpansionUse::Words));
   }
+  cmd_s = words;
+  std::string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
 
-  return nullptr;
+  // Builtins run in the shell itself, assignments before them are ignored.
+  const BuiltinEntry *builtin = _findBuiltin(firstWord);
+  if (builtin) {
+    if (outClone) {
+      *outClone = builtin->clone;
+    }
+    return builtin->factory(display, cmd_s);
+  }
+  if (outClone) {
+    *outClone = _cloneCommand<ExternalCommand>;
+  }
+  return std::make_shared<ExternalCommand>(
+      display, cmd_s, background_flag, assignments,
+      _trim(_substitute(text, expansions, ExpansionUse::Quoted)));
 }
 
 std::shared_ptr<Command>
@@ -218,246 +616,1022 @@ SmallShell::CreateCommand(const std::string &cmd_line) {
   return CreateCommandImpl(cmd_line, cmd_line);
 }
 
-void SmallShell::CreateRedirectCommand(const std::string &cmd_line,
-                                       std::shared_ptr<Command> &outCommand,
-                                       std::string &outFileName) {
-  bool appendFlag = std::string(cmd_line).find(">>") != std::string::npos;
-  size_t index = std::string(cmd_line).find(appendFlag ? ">>" : ">");
+bool SmallShell::CreateRedirectCommand(const std::string &cmd_line,
+                                       ParsedCommand &outCommand,
+                                       std::string *bodies,
+                                       const Expansions *expansions) {
+  std::string command;
+  if (!parseRedirections(cmd_line, command, outCommand.plan, bodies) ||
+      _trim(command).empty()) {
+    std::cerr << "smash error: invalid redirection" << std::endl;
+    return false;
+  }
+  _substitutePlan(outCommand.plan, expansions);
 
-  auto command = _trim(std::string(cmd_line).substr(0, index));
-  auto fileName =
-      _trim(std::string(cmd_line).substr(index + (appendFlag ? 2 : 1)));
+  outCommand.prototype =
+      CreateCommandImpl(command, cmd_line, &outCommand.clone, expansions);
+  return true;
+}
 
-  outCommand = CreateCommandImpl(command, cmd_line);
-  outFileName = fileName;
+bool SmallShell::CreatePipeCommand(const std::string &cmd_line,
+                                   ParsedCommand &outCommand1,
+                                   ParsedCommand &outCommand2,
+                                   std::string *bodies,
+                                   const Expansions *expansions) {
+  size_t index = _findPipe(cmd_line);
+  bool errFlag = cmd_line.compare(index, 2, "|&") == 0;
+
+  std::string command1, command2;
+  if (!parseRedirections(std::string(cmd_line).substr(0, index), command1,
+                         outCommand1.plan, bodies) ||
+      !parseRedirections(
+          std::string(cmd_line).substr(index + (errFlag ? 2 : 1)), command2,
+          outCommand2.plan, bodies) ||
+      _trim(command1).empty() || _trim(command2).empty()) {
+    std::cerr << "smash error: invalid redirection" << std::endl;
+    return false;
+  }
+  _substitutePlan(outCommand1.plan, expansions);
+  _substitutePlan(outCommand2.plan, expansions);
+
+  outCommand1.prototype =
+      CreateCommandImpl(command1, cmd_line, &outCommand1.clone, expansions);
+  outCommand2.prototype =
+      CreateCommandImpl(command2, cmd_line, &outCommand2.clone, expansions);
+  return true;
 }
 
-void SmallShell::CreatePipeCommand(const std::string &cmd_line,
-                                   std::shared_ptr<Command> &outCommand1,
-                                   std::shared_ptr<Command> &outCommand2) {
-  bool errFlag = std::string(cmd_line).find("|&") != std::string::npos;
-  size_t index = std::string(cmd_line).find(errFlag ? "|&" : "|");
+void SmallShell::executeCommand(const char *cmd_line) {
+  runLine(cmd_line, false);
+}
 
-  auto command1 = _trim(std::string(cmd_line).substr(0, index));
-  auto command2 =
-      _trim(std::string(cmd_line).substr(index + (errFlag ? 2 : 1)));
+/**
+ * Like executeCommand, but a foreground external command is only started.
+ * Its pid is returned and waiting for it is up to the caller. Returns -1 if
+ * the command already finished, getLastStatus() then tells how.
+ */
+pid_t SmallShell::startCommand(const char *cmd_line) {
+  return runLine(cmd_line, true);
+}
 
-  outCommand1 = CreateCommandImpl(command1, cmd_line);
-  outCommand2 = CreateCommandImpl(command2, cmd_line);
+/**
+ * Runs cmd_line as part of the line being run, with every command it forks
+ * started under limits.
+ */
+void SmallShell::runLimited(const std::string &cmd_line,
+                            const ResourceLimits &limits) {
+  launch_limits = &limits;
+  dispatchCommand(cmd_line.c_str(), false);
+  launch_limits = nullptr;
 }
 
-void SmallShell::executeCommand(const char *cmd_line) {
-  jobs.removeFinishedJobs();
+/**
+ * Starts cmd_line as a background job, like cmd_line with a trailing &.
+ * Only a single command that forks can be a job, returns its job id, or -1
+ * if cmd_line is anything else or could not be started.
+ */
+int SmallShell::startJob(const std::string &cmd_line) {
+  std::string line = _trim(cmd_line);
+  if (line.empty() || line.back() != '&') {
+    line += "&";
+  }
 
-  auto type = checkType(cmd_line);
-  if (type == CommandType::Regular) {
-    auto command = CreateCommand(cmd_line);
+  ParsedLine parsed;
+  if (!lookupLine(line.c_str(), parsed)) {
+    return -1;
+  }
+  ParsedCommand &first = parsed.commands[0];
+  if (parsed.type == CommandType::Pipe ||
+      parsed.type == CommandType::PipeErr ||
+      first.prototype->kind() == CommandKind::BuiltIn) {
+    return -1;
+  }
+  // Kept to read the job id back, which the job list gives the command.
+  std::shared_ptr<Command> command = first.clone(*first.prototype);
+  runCommand(command, first.plan, false);
+  return command->getJobId();
+}
 
-    // Check if builtin or external
-    bool isExternal = dynamic_cast<ExternalCommand *>(command.get()) != nullptr;
-    if (isExternal) {
-      int pid = fork();
-      if (pid == -1) {
-        syscallError("fork");
-        return;
-      }
+int SmallShell::getLastStatus() const { return last_status; }
 
-      if (pid == 0) {
-        // Forked child
-        command->execute(this);
-      } else {
-        // Parent
-        if (command->isBackgroundCommand()) {
-          jobs.addJob(command, pid, false);
-        } else {
-          current_command_pid = pid;
-          current_command = command.get();
-
-          int waitStatus;
-          if (waitpid(pid, &waitStatus, WUNTRACED) == -1) {
-            syscallError("waitpid");
-          }
-          current_command_pid = -1;
-          current_command = nullptr;
-
-          if (WIFSTOPPED(waitStatus)) {
-            jobs.addJob(command, pid, true);
-            std::cout << "smash: process " << pid << " was stopped"
-                      << std::endl;
-          }
-        }
-      }
+pid_t SmallShell::runLine(const char *cmd_line, bool detach) {
+  // The history is a line per command, here-document bodies are left out.
+  const char *newline = strchr(cmd_line, '\n');
+  std::string line = newline ? std::string(cmd_line, newline) : cmd_line;
+  if (!_trim(line).empty()) {
+    history.add(line);
+  }
+  pid_t pid = dispatchCommand(cmd_line, detach);
 
-    } else {
-      command->execute(this);
-    }
-  } else if (type == CommandType::Redirect ||
-             type == CommandType::RedirectAppend) {
-    std::shared_ptr<Command> command;
-    std::string fileName;
-    CreateRedirectCommand(cmd_line, command, fileName);
-
-    bool isExternal = dynamic_cast<ExternalCommand *>(command.get()) != nullptr;
-    if (isExternal) {
-      int pid = fork();
-      if (pid == -1) {
-        syscallError("fork");
-        return;
-      }
+  // Builtin output is buffered for the whole command, write it out at once.
+  std::cout.flush();
+  return pid;
+}
 
-      if (pid == 0) {
-        // Forked child
-        auto fd =
-            open(fileName.c_str(),
-                 type == CommandType::Redirect ? O_WRONLY | O_CREAT | O_TRUNC
-                                               : O_WRONLY | O_CREAT | O_APPEND,
-                 0666);
-        if (fd == -1) {
-          syscallError("open");
-          exit(1);
-        }
+pid_t SmallShell::dispatchCommand(const char *cmd_line, bool detach) {
+  jobs.removeFinishedJobs();
+  last_status = 0;
+
+  // Like bash's, time covers the whole line, pipes and redirections too.
+  std::string trimmed = _trim(cmd_line);
+  if (trimmed.compare(0, 4, "time") == 0 &&
+      (trimmed.length() == 4 ||
+       WHITESPACE.find(trimmed[4]) != std::string::npos)) {
+    runTimed(trimmed.substr(4));
+    return -1;
+  }
 
-        close(STDOUT_FILENO);
-        dup(fd);
+  ParsedLine parsed;
+  if (!lookupLine(cmd_line, parsed)) {
+    last_status = 1;
+    return -1;
+  }
+  return runParsed(parsed, detach);
+}
 
-        command->execute(this);
-      } else {
-        // Parent
-        if (waitpid(pid, nullptr, 0) == -1) {
-          syscallError("waitpid");
-        }
-      }
-    } else {
-      // Runs locally so we can open the file and switch the streams easily.
-      std::fstream file(fileName, type == CommandType::Redirect
-                                      ? std::fstream::out | std::fstream::trunc
-                                      : std::fstream::out | std::fstream::app);
-      auto originalBuf = std::cout.rdbuf(file.rdbuf());
+/**
+ * Parses cmd_line, or copies it from the parse cache. Repeated lines skip
+ * parsing, only the commands are copied for each run.
+ */
+bool SmallShell::lookupLine(const char *cmd_line, ParsedLine &outLine) {
+  // What a line with $ in it expands to changes from run to run, it is
+  // expanded and parsed every time.
+  if (strchr(cmd_line, '$')) {
+    std::string line;
+    Expansions expansions;
+    if (!expandLine(cmd_line, line, expansions)) {
+      return false;
+    }
+    TraceScope scope("shell", "parse", cmd_line);
+    return parseLine(line, outLine, &expansions);
+  }
 
-      command->execute(this);
+  const ParsedLine *cached = parse_cache.get(cmd_line);
+  if (cached) {
+    traceInstant("shell", "parse (cached)", 0, cmd_line);
+    outLine = *cached;
+    return true;
+  }
 
-      std::cout.rdbuf(originalBuf);
-    }
-  } else if (type == CommandType::Pipe || type == CommandType::PipeErr) {
-    std::shared_ptr<Command> command1, command2;
-    CreatePipeCommand(cmd_line, command1, command2);
+  TraceScope scope("shell", "parse", cmd_line);
+  if (!parseLine(cmd_line, outLine)) {
+    return false;
+  }
+  parse_cache.put(cmd_line, outLine);
+  return true;
+}
 
-    int pipe[2];
-    if (::pipe(pipe) == -1) {
-      syscallError("pipe");
-      return;
-    }
+pid_t SmallShell::runParsed(ParsedLine &parsed, bool detach) {
+  ParsedCommand &first = parsed.commands[0];
+  ParsedCommand &second = parsed.commands[1];
+  if (parsed.type == CommandType::Pipe || parsed.type == CommandType::PipeErr) {
+    runPipe(first.clone(*first.prototype), first.plan,
+            second.clone(*second.prototype), second.plan,
+            parsed.type == CommandType::PipeErr);
+    return -1;
+  }
+  return runCommand(first.clone(*first.prototype), first.plan, detach);
+}
 
-    int read = pipe[0];
-    int write = pipe[1];
-    int output = type == CommandType::Pipe ? STDOUT_FILENO : STDERR_FILENO;
+/**
+ * Runs the line after a time prefix and reports how long it took and what
+ * it used. The line is waited for even if it was started from --listen.
+ */
+void SmallShell::runTimed(const std::string &cmd_line) {
+  // time [-v] [-j] line: -v adds memory, faults and context switches, -j
+  // reports it all as JSON.
+  bool verbose = false;
+  bool json = false;
+  std::string line = _trim(cmd_line);
+  while (line.compare(0, 2, "-v") == 0 || line.compare(0, 2, "-j") == 0) {
+    if (line.length() > 2 && WHITESPACE.find(line[2]) == std::string::npos) {
+      break;
+    }
+    (line[1] == 'v' ? verbose : json) = true;
+    line = _trim(line.substr(2));
+  }
+  if (line.empty()) {
+    std::cerr << "smash error: time: invalid arguments" << std::endl;
+    last_status = 1;
+    return;
+  }
 
-    bool isExternal1 =
-        dynamic_cast<ExternalCommand *>(command1.get()) != nullptr;
-    if (isExternal1) {
-      int pid = fork();
-      if (pid == -1) {
-        syscallError("fork");
-        return;
-      }
+  ParsedLine parsed;
+  if (!lookupLine(line.c_str(), parsed)) {
+    last_status = 1;
+    return;
+  }
 
-      if (pid == 0) {
-        // Forked child
-        close(read);
-        dup2(write, output);
+  TimedUsage usage;
+  TimedUsage *outer = timed_usage;
+  timed_usage = &usage;
+  struct rusage before;
+  getrusage(RUSAGE_SELF, &before);
+  uint64_t start = _monotonicNanos();
+  runParsed(parsed, false);
+  uint64_t wall = _monotonicNanos() - start;
+  timed_usage = outer;
+  if (outer && usage.processes > 0) {
+    outer->add(usage.children);
+  }
 
-        command1->execute(this);
-      } else {
-        // Parent
-        if (waitpid(pid, nullptr, 0) == -1) {
-          syscallError("waitpid");
-        }
-      }
-    } else {
-      int originalOut = dup(output);
-      dup2(write, output);
+  std::cout.flush();
+  std::cerr << formatTimes(wall, usage, before, last_status, verbose, json);
+}
 
-      command1->execute(this);
+/**
+ * waitpid that also adds what a reaped process used to a running time.
+ */
+pid_t SmallShell::waitChild(pid_t pid, int *status, int options) {
+  int waitStatus;
+  struct rusage usage;
+  pid_t res = wait4(pid, &waitStatus, options, &usage);
+  if (res > 0 && timed_usage && !WIFSTOPPED(waitStatus)) {
+    timed_usage->add(usage);
+  }
+  if (res > 0 && status) {
+    *status = waitStatus;
+  }
+  return res;
+}
 
-      dup2(originalOut, output);
+/**
+ * Expands every $NAME and ${NAME} in cmd_line to the variable's value, and
+ * every $(...) to what the command inside printed. outLine gets a
+ * placeholder for each, their values go to outExpansions. A $ that starts
+ * none of these is kept as it is.
+ */
+bool SmallShell::expandLine(const std::string &cmd_line, std::string &outLine,
+                            Expansions &outExpansions) {
+  outLine.clear();
+  outExpansions.clear();
+  size_t position = 0;
+  size_t start;
+  while ((start = cmd_line.find('$', position)) != std::string::npos) {
+    outLine.append(cmd_line, position, start - position);
+    char next = start + 1 < cmd_line.length() ? cmd_line[start + 1] : '\0';
+
+    if (next == '{') {
+      size_t end = cmd_line.find('}', start);
+      std::string name = end == std::string::npos
+                             ? ""
+                             : cmd_line.substr(start + 2, end - start - 2);
+      if (!isValidName(name)) {
+        std::cerr << "smash error: bad substitution" << std::endl;
+        return false;
+      }
+      const std::string *value = environment.get(name);
+      outLine += _expansionPlaceholder(outExpansions.size());
+      outExpansions.push_back(value ? *value : "");
+      position = end + 1;
+      continue;
     }
-    close(write);
 
-    bool isExternal2 =
-        dynamic_cast<ExternalCommand *>(command2.get()) != nullptr;
-    if (isExternal2) {
-      int pid = fork();
-      if (pid == -1) {
-        syscallError("fork");
-        return;
+    if (next != '(') {
+      size_t end = start + 1;
+      while (end < cmd_line.length() &&
+             (isalnum((unsigned char)cmd_line[end]) || cmd_line[end] == '_')) {
+        end++;
       }
-
-      if (pid == 0) {
-        // Forked child
-        dup2(read, STDIN_FILENO);
-
-        command2->execute(this);
-      } else {
-        // Parent
-        if (waitpid(pid, nullptr, 0) == -1) {
-          syscallError("waitpid");
-        }
+      std::string name = cmd_line.substr(start + 1, end - start - 1);
+      if (!isValidName(name)) {
+        outLine += '$';
+        position = start + 1;
+        continue;
       }
-    } else {
-      int originalIn = dup(STDIN_FILENO);
-      dup2(read, STDIN_FILENO);
+      const std::string *value = environment.get(name);
+      outLine += _expansionPlaceholder(outExpansions.size());
+      outExpansions.push_back(value ? *value : "");
+      position = end;
+      continue;
+    }
 
-      command2->execute(this);
+    // Nested substitutions are expanded when the inner line runs.
+    size_t end = start + 2;
+    for (int depth = 1; depth > 0; end++) {
+      if (end == cmd_line.length()) {
+        std::cerr << "smash error: unterminated command substitution"
+                  << std::endl;
+        return false;
+      }
+      if (cmd_line[end] == '(') {
+        depth++;
+      } else if (cmd_line[end] == ')') {
+        depth--;
+      }
+    }
 
-      dup2(originalIn, STDIN_FILENO);
+    std::string output;
+    if (!captureOutput(cmd_line.substr(start + 2, end - start - 3), output)) {
+      return false;
     }
-    close(read);
+    // Like in bash, trailing newlines are dropped. Every word becomes an
+    // argument, argv only has room for so many.
+    output.erase(output.find_last_not_of('\n') + 1);
+    std::string words;
+    if (_appendWords(words, output) > COMMAND_MAX_ARGS) {
+      std::cerr << "smash error: command substitution: too many words"
+                << std::endl;
+      return false;
+    }
+    outLine += _expansionPlaceholder(outExpansions.size());
+    outExpansions.push_back(output);
+    position = end;
   }
+  outLine.append(cmd_line, position, std::string::npos);
+  return true;
 }
 
-//                                                                 //
-//------------------------Command functions------------------------//
-//                                                                 //
-Command::Command(const std::string &cmd_line,
-                 const std::string &cmd_line_stripped,
-                 bool background_command_flag)
-    : command_line(cmd_line), argv(new char *[MAX_ARGV_LENGTH]),
-      argc(_parseCommandLine(cmd_line_stripped, argv)),
-      background_command_flag(background_command_flag),
-      startTime(time(nullptr)), jobId(-1) {}
-
-Command::~Command() {
-  for (int i = 0; i < argc; i++) {
-    delete argv[i];
-    argv[i] = NULL;
+/**
+ * Runs cmd_line and returns what it wrote to stdout.
+ *
+ * Builtins that only print run on a string buffer, with no fork and no
+ * pipe. A single external command writes into a pipe that is read while it
+ * runs. Anything else, pipelines and redirections, runs with the shell's
+ * stdout on a memfd, which can hold whatever the shell itself writes while
+ * it waits.
+ */
+bool SmallShell::captureOutput(const std::string &cmd_line,
+                               std::string &outOutput) {
+  TraceScope scope("shell", "substitution", cmd_line.c_str());
+  ParsedLine parsed;
+  if (!lookupLine(cmd_line.c_str(), parsed)) {
+    return false;
+  }
+  // Whatever was printed so far belongs before this command's output.
+  std::cout.flush();
+
+  ParsedCommand &first = parsed.commands[0];
+  if (parsed.type == CommandType::Regular && first.prototype->printsOnly()) {
+    auto command = first.clone(*first.prototype);
+    std::stringbuf buffer;
+    std::streambuf *previous = std::cout.rdbuf(&buffer);
+    command->execute(this);
+    std::cout.rdbuf(previous);
+    outOutput = buffer.str();
+    return true;
   }
-  delete[] argv;
-}
 
-const std::string Command::getCommandLine() const { return command_line; }
-const time_t &Command::getStartTime() const { return startTime; }
-int Command::getJobId() const { return jobId; }
-void Command::setJobId(int id) { jobId = id; }
-bool Command::isBackgroundCommand() const { return background_command_flag; }
+  if (parsed.type == CommandType::Regular &&
+      first.prototype->kind() == CommandKind::External &&
+      !first.prototype->isBackgroundCommand()) {
+    int outputPipe[2];
+    if (pipe2(outputPipe, O_CLOEXEC) == -1) {
+      syscallError("pipe");
+      return false;
+    }
+    auto command = first.clone(*first.prototype);
+    RedirectionPlan plan = {FdAction::dup(STDOUT_FILENO, outputPipe[1])};
+    pid_t pid = runCommand(command, plan, true);
+    close(outputPipe[1]);
+    if (pid == -1) {
+      close(outputPipe[0]);
+      return false;
+    }
 
-ChangePromptCommand::ChangePromptCommand(const std::string &cmd_line,
-                                         const std::string &cmd_line_stripped)
-    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+    int waitStatus;
+    setCurrentCommandPid(pid);
+    current_command = command.get();
+    bool ok = readForeground(pid, outputPipe[0], outOutput, &waitStatus);
+    close(outputPipe[0]);
+    setCurrentCommandPid(-1);
+    current_command = nullptr;
+    if (!ok) {
+      syscallError("waitpid");
+      return false;
+    }
+    last_status = exitStatus(waitStatus);
+    if (WIFSTOPPED(waitStatus)) {
+      jobs.addJob(std::move(command), pid, true);
+      std::cout << "smash: process " << pid << " was stopped" << '\n';
+    }
+    return true;
+  }
 
-void ChangePromptCommand::execute(SmallShell *smash) {
-  if (argc == 1) {
-    smash->setDisplayPrompt("smash");
-  } else {
-    smash->setDisplayPrompt(std::string(argv[1]));
+  int outputFd = memfd_create("smash-substitution", MFD_CLOEXEC);
+  if (outputFd == -1) {
+    syscallError("memfd_create");
+    return false;
+  }
+  {
+    SavedFds saved;
+    RedirectionPlan plan = {FdAction::dup(STDOUT_FILENO, outputFd)};
+    if (!saved.apply(plan)) {
+      close(outputFd);
+      return false;
+    }
+    runParsed(parsed, false);
+    std::cout.flush();
   }
-}
+
+  off_t size = lseek(outputFd, 0, SEEK_CUR);
+  outOutput.resize(size > 0 ? size : 0);
+  ssize_t res = size > 0 ? pread(outputFd, &outOutput[0], size, 0) : 0;
+  close(outputFd);
+  if (res == -1) {
+    syscallError("pread");
+    return false;
+  }
+  outOutput.resize(res);
+  return true;
+}
+
+/**
+ * Reads a foreground command's stdout pipe until it is closed, then waits
+ * for the command. The pipe is read while the command runs, a command that
+ * writes more than the pipe holds would never finish otherwise. Stops
+ * early if the command was stopped. The pipe is read by the reactor, so
+ * other events are still handled.
+ */
+bool SmallShell::readForeground(pid_t pid, int fd, std::string &outOutput,
+                                int *status) {
+  size_t used = 0;
+  bool open = true;
+  outOutput.resize(4096);
+  bool watched = reactor.add(fd, EPOLLIN, [&](uint32_t) {
+    // The buffer doubles whenever it fills up.
+    if (used == outOutput.size()) {
+      outOutput.resize(outOutput.size() * 2);
+    }
+    ssize_t res = read(fd, &outOutput[used], outOutput.size() - used);
+    if (res == -1 && errno == EINTR) {
+      return;
+    }
+    if (res <= 0) {
+      open = false;
+      return;
+    }
+    used += res;
+  });
+  if (!watched) {
+    syscallError("epoll_ctl");
+  }
+
+  pid_t savedEcho = echo_pid;
+  echo_pid = pid;
+  unsigned long rounds = signal_rounds;
+  runEvents([&]() {
+    if (!watched || !open) {
+      return true;
+    }
+    if (rounds == signal_rounds) {
+      return false;
+    }
+    rounds = signal_rounds;
+    // A stopped command keeps its pipe open, there is no EOF to wait for.
+    siginfo_t info = {};
+    waitid(P_PID, pid, &info, WSTOPPED | WEXITED | WNOHANG | WNOWAIT);
+    return info.si_pid == pid && info.si_code == CLD_STOPPED;
+  });
+  echo_pid = savedEcho;
+  reactor.remove(fd);
+
+  outOutput.resize(used);
+  return waitForeground(pid, status);
+}
+
+bool SmallShell::parseLine(const std::string &cmd_line, ParsedLine &outLine,
+                           const Expansions *expansions) {
+  // Here-document bodies follow the command, on lines of their own.
+  size_t newline = cmd_line.find('\n');
+  std::string line = cmd_line.substr(0, newline);
+  std::string bodies =
+      newline == std::string::npos ? "" : cmd_line.substr(newline + 1);
+
+  outLine.type = checkType(line);
+  if (outLine.type == CommandType::Regular) {
+    ParsedCommand &command = outLine.commands[0];
+    command.prototype =
+        CreateCommandImpl(line, line, &command.clone, expansions);
+    return true;
+  } else if (outLine.type == CommandType::Redirect) {
+    return CreateRedirectCommand(line, outLine.commands[0], &bodies,
+                                 expansions);
+  }
+  return CreatePipeCommand(line, outLine.commands[0], outLine.commands[1],
+                           &bodies, expansions);
+}
+
+/**
+ * Runs the two sides of a pipe. External sides are forked before anything
+ * is waited for so neither blocks on a full pipe, builtins run in the shell.
+ * If the first command tees its output, the shell moves the data into the
+ * pipe and the files itself while the commands run.
+ */
+void SmallShell::runPipe(std::shared_ptr<Command> command1,
+                         RedirectionPlan &plan1,
+                         std::shared_ptr<Command> command2,
+                         RedirectionPlan &plan2, bool errPipe) {
+  std::vector<std::string> teePaths;
+  if (!extractTeeTargets(plan1, teePaths) ||
+      !extractTeeTargets(plan2, teePaths)) {
+    std::cerr << "smash error: invalid redirection" << std::endl;
+    return;
+  }
+
+  std::vector<int> teeFiles;
+  if (!openTeeFiles(teePaths, teeFiles)) {
+    return;
+  }
+
+  int pipe[2];
+  if (::pipe2(pipe, O_CLOEXEC) == -1) {
+    syscallError("pipe");
+    closeTeeFiles(teeFiles);
+    return;
+  }
+
+  int read = pipe[0];
+  int write = pipe[1];
+
+  bool isExternal1 = command1->kind() != CommandKind::BuiltIn;
+  bool isExternal2 = command2->kind() != CommandKind::BuiltIn;
+
+  // With a tee the first command writes into a pipe of its own, which the
+  // shell then copies into the pipe between the commands. A builtin writes
+  // into a memfd instead, nobody could drain a pipe while it runs.
+  int teePipe[2] = {-1, -1};
+  int teeBuffer = -1;
+  if (!teeFiles.empty() && isExternal1 && !openTeePipe(teePipe)) {
+    close(read);
+    close(write);
+    closeTeeFiles(teeFiles);
+    return;
+  }
+  if (!teeFiles.empty() && !isExternal1) {
+    teeBuffer = memfd_create("smash-tee", MFD_CLOEXEC);
+    if (teeBuffer == -1) {
+      syscallError("memfd_create");
+      close(read);
+      close(write);
+      closeTeeFiles(teeFiles);
+      return;
+    }
+  }
+
+  // The pipe ends go first so the command's own redirections override them.
+  plan1.insert(plan1.begin(), FdAction::dup(STDOUT_FILENO, write));
+  if (errPipe) {
+    plan1.insert(plan1.begin() + 1, FdAction::dup(STDERR_FILENO, write));
+  }
+  if (teePipe[1] != -1) {
+    plan1.push_back(FdAction::dup(STDOUT_FILENO, teePipe[1]));
+  }
+  if (teeBuffer != -1) {
+    plan1.push_back(FdAction::dup(STDOUT_FILENO, teeBuffer));
+  }
+  plan2.insert(plan2.begin(), FdAction::dup(STDIN_FILENO, read));
+
+  pid_t pid1 = -1, pid2 = -1;
+  if (isExternal2) {
+    pid2 = forkCommand(command2, plan2);
+  }
+  if (isExternal1) {
+    pid1 = forkCommand(command1, plan1);
+  } else {
+    SavedFds saved;
+    TraceScope scope("builtin", command1->getName());
+    if (saved.apply(plan1)) {
+      command1->execute(this);
+    }
+    std::cout.flush();
+  }
+
+  if (!isExternal2) {
+    SavedFds saved;
+    TraceScope scope("builtin", command2->getName());
+    if (saved.apply(plan2)) {
+      command2->execute(this);
+    }
+    std::cout.flush();
+  }
+  // Only the second command may hold the read end, otherwise a tee into a
+  // pipe nobody reads anymore would block forever.
+  close(read);
+
+  if (teePipe[0] != -1) {
+    close(teePipe[1]);
+    teeOutput(teePipe[0], write, teeFiles);
+    close(teePipe[0]);
+    closeTeeFiles(teeFiles);
+  }
+  if (teeBuffer != -1) {
+    copyOutput(teeBuffer, write, teeFiles);
+    close(teeBuffer);
+    closeTeeFiles(teeFiles);
+  }
+  close(write);
+
+  PidWatch watch1(reactor, pid1);
+  PidWatch watch2(reactor, pid2);
+  waitForEvents(
+      -1,
+      [&]() {
+        // Each watch goes as soon as its command is reaped, the other one
+        // may still run for a long time.
+        if (pid1 != -1 && waitChild(pid1, nullptr, WNOHANG) != 0) {
+          traceInstant("process", "reap", pid1);
+          pid1 = -1;
+          watch1.reset();
+        }
+        int waitStatus;
+        int res = pid2 == -1 ? 0 : waitChild(pid2, &waitStatus, WNOHANG);
+        if (res > 0) {
+          traceInstant("process", "reap", pid2);
+          last_status = exitStatus(waitStatus);
+        }
+        if (res != 0) {
+          pid2 = -1;
+          watch2.reset();
+        }
+        return pid1 == -1 && pid2 == -1;
+      },
+      false);
+}
+
+bool SmallShell::openTeeFiles(const std::vector<std::string> &paths,
+                              std::vector<int> &outFds) {
+  for (auto &&path : paths) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd == -1) {
+      syscallError("open");
+      closeTeeFiles(outFds);
+      return false;
+    }
+    outFds.push_back(fd);
+  }
+  return true;
+}
+
+void SmallShell::closeTeeFiles(std::vector<int> &fds) {
+  for (int fd : fds) {
+    close(fd);
+  }
+  fds.clear();
+}
+
+/**
+ * Creates the pipe a teeing command writes into. It is made as large as the
+ * system allows, so a builtin can write its whole output before the shell
+ * starts moving it.
+ */
+bool SmallShell::openTeePipe(int teePipe[2]) {
+  if (pipe2(teePipe, O_CLOEXEC) == -1) {
+    syscallError("pipe");
+    return false;
+  }
+
+  std::ifstream maxSizeFile("/proc/sys/fs/pipe-max-size");
+  int maxSize;
+  if (maxSizeFile >> maxSize) {
+    fcntl(teePipe[1], F_SETPIPE_SZ, maxSize);
+  }
+  return true;
+}
+
+/**
+ * Runs a single command with its redirections. External commands get forked
+ * and either waited for or added to the jobs list, builtins run in the shell
+ * with the shell's own fds redirected for the duration of the command. With
+ * detach, a foreground external command is not waited for and its pid is
+ * returned, otherwise -1 is.
+ */
+pid_t SmallShell::runCommand(std::shared_ptr<Command> command,
+                             RedirectionPlan &plan, bool detach) {
+  std::vector<std::string> teePaths;
+  if (!extractTeeTargets(plan, teePaths)) {
+    std::cerr << "smash error: invalid redirection" << std::endl;
+    return -1;
+  }
+  if (!teePaths.empty() && command->isBackgroundCommand()) {
+    std::cerr << "smash error: tee: can not run in the background"
+              << std::endl;
+    return -1;
+  }
+
+  std::vector<int> teeFiles;
+  int teePipe[2] = {-1, -1};
+  if (!openTeeFiles(teePaths, teeFiles)) {
+    return -1;
+  }
+
+  bool isExternal = command->kind() != CommandKind::BuiltIn;
+  if (!isExternal) {
+    // A builtin runs in the shell, which can not drain a tee pipe at the
+    // same time, so its output is kept in a memfd until it is done.
+    int teeBuffer = -1;
+    if (!teeFiles.empty()) {
+      teeBuffer = memfd_create("smash-tee", MFD_CLOEXEC);
+      if (teeBuffer == -1) {
+        syscallError("memfd_create");
+        closeTeeFiles(teeFiles);
+        return -1;
+      }
+      plan.push_back(FdAction::dup(STDOUT_FILENO, teeBuffer));
+    }
+    // Buffered output belongs to the fds as they are now.
+    std::cout.flush();
+    {
+      SavedFds saved;
+      TraceScope scope("builtin", command->getName());
+      if (saved.apply(plan)) {
+        command->execute(this);
+      }
+      std::cout.flush();
+    }
+    if (teeBuffer != -1) {
+      copyOutput(teeBuffer, STDOUT_FILENO, teeFiles);
+      close(teeBuffer);
+      closeTeeFiles(teeFiles);
+    }
+    return -1;
+  }
+
+  if (!teeFiles.empty()) {
+    if (!openTeePipe(teePipe)) {
+      closeTeeFiles(teeFiles);
+      return -1;
+    }
+    plan.push_back(FdAction::dup(STDOUT_FILENO, teePipe[1]));
+  }
+
+  // Captured background jobs write into a pipe the shell drains, their own
+  // redirections still take precedence.
+  int capturePipe[2] = {-1, -1};
+  if (command->isBackgroundCommand() &&
+      jobs.getCapture()->openPipe(capturePipe)) {
+    plan.insert(plan.begin(), FdAction::dup(STDOUT_FILENO, capturePipe[1]));
+    plan.insert(plan.begin() + 1,
+                FdAction::dup(STDERR_FILENO, capturePipe[1]));
+  }
+
+  pid_t pid = forkCommand(command, plan);
+  if (teePipe[0] != -1) {
+    close(teePipe[1]);
+  }
+  if (capturePipe[1] != -1) {
+    close(capturePipe[1]);
+  }
+  if (pid == -1) {
+    if (teePipe[0] != -1) {
+      close(teePipe[0]);
+      closeTeeFiles(teeFiles);
+    }
+    if (capturePipe[0] != -1) {
+      close(capturePipe[0]);
+    }
+    return -1;
+  }
+
+  if (command->isBackgroundCommand()) {
+    int jobId = jobs.addJob(std::move(command), pid, false);
+    if (capturePipe[0] != -1) {
+      jobs.getCapture()->attach(capturePipe[0], pid, jobId);
+    }
+    return -1;
+  }
+
+  // Only the shell can move a tee's data, so those are always waited for.
+  if (detach && teePipe[0] == -1) {
+    return pid;
+  }
+
+  setCurrentCommandPid(pid);
+  current_command = command.get();
+
+  if (teePipe[0] != -1) {
+    teeOutput(teePipe[0], STDOUT_FILENO, teeFiles);
+    close(teePipe[0]);
+    closeTeeFiles(teeFiles);
+  }
+
+  int waitStatus;
+  if (!waitForeground(pid, &waitStatus)) {
+    syscallError("waitpid");
+  }
+  setCurrentCommandPid(-1);
+  current_command = nullptr;
+  last_status = exitStatus(waitStatus);
+
+  if (WIFSTOPPED(waitStatus)) {
+    jobs.addJob(std::move(command), pid, true);
+    std::cout << "smash: process " << pid << " was stopped" << '\n';
+  }
+  return -1;
+}
+
+/**
+ * Blocks until new input can be read. While waiting, the output of captured
+ * background jobs keeps being drained so they never block on a full pipe.
+ */
+void SmallShell::waitForInput() {
+  processSignalEvents();
+  // Whatever std::cin already buffered can be read right away.
+  if (std::cin.rdbuf()->in_avail() > 0) {
+    return;
+  }
+
+  // epoll refuses regular files, which never block anyway.
+  bool ready = false;
+  if (!reactor.add(STDIN_FILENO, EPOLLIN, [&](uint32_t) { ready = true; })) {
+    return;
+  }
+  runEvents([&]() { return ready; });
+  reactor.remove(STDIN_FILENO);
+}
+
+/**
+ * The capture epoll set only exists once a job was captured, so it is
+ * looked for whenever the reactor runs.
+ */
+void SmallShell::watchCapture() {
+  int fd = jobs.getCapture()->getFd();
+  if (fd != -1 && !reactor.isWatched(fd)) {
+    reactor.add(fd, EPOLLIN,
+                [this](uint32_t) { jobs.getCapture()->drain(echo_pid); });
+  }
+}
+
+bool SmallShell::runEvents(const std::function<bool()> &done,
+                           int timeoutMs) {
+  watchCapture();
+  return reactor.runUntil(done, timeoutMs);
+}
+
+/**
+ * waitpid for a foreground command, also reports stops. The reactor keeps
+ * running while waiting, a captured job's output is echoed while it runs in
+ * the foreground and every other event is handled as usual.
+ */
+bool SmallShell::waitForeground(pid_t pid, int *status) {
+  auto capture = jobs.getCapture();
+  bool ok = true;
+  // The exit wakes the reactor up even if SIGCHLD is not handled.
+  PidWatch watch(reactor, pid);
+  waitForEvents(
+      pid,
+      [&]() {
+        int res = waitChild(pid, status, WNOHANG | WUNTRACED);
+        if (res > 0) {
+          traceInstant("process", WIFSTOPPED(*status) ? "stop" : "reap", pid);
+        }
+        ok = res != -1;
+        return res != 0;
+      },
+      false);
+  // Whatever the job wrote right before it exited.
+  capture->drain(pid);
+  return ok;
+}
+
+/**
+ * Echoes a captured job's output until its pipe is closed or the user
+ * interrupts with Ctrl-C/Ctrl-Z. Returns false if the job is not captured.
+ */
+bool SmallShell::followJobOutput(pid_t pid) {
+  auto capture = jobs.getCapture();
+  if (!capture->isCaptured(pid)) {
+    return false;
+  }
+
+  std::cout.flush();
+  waitForEvents(
+      pid,
+      [&]() {
+        capture->drain(pid);
+        // Peek at the job without reaping it, that is left to the jobs list.
+        siginfo_t info = {};
+        waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT);
+        return !capture->hasOpenPipe(pid) || info.si_pid == pid;
+      },
+      true);
+  return true;
+}
+
+/**
+ * Runs the reactor until done() returns true: signals are acted on, captured
+ * output drained and exited jobs reaped meanwhile. done() is checked after
+ * every round of events. If interruptible, ctrl-C or ctrl-Z stops the wait
+ * early.
+ */
+bool SmallShell::waitForEvents(pid_t echoPid,
+                               const std::function<bool()> &done,
+                               bool interruptible) {
+  pid_t savedEcho = echo_pid;
+  echo_pid = echoPid;
+  unsigned long start = interrupts;
+  bool interrupted = false;
+  bool ok = runEvents([&]() {
+    interrupted = interruptible && interrupts != start;
+    return interrupted || done();
+  });
+  echo_pid = savedEcho;
+  if (!ok || interrupted) {
+    return false;
+  }
+  // A signal that raced with done() is reported before the caller goes on.
+  processSignalEvents();
+  return true;
+}
+
+/**
+ * Forks a child that applies the redirection plan and runs the command.
+ * Returns the child's pid, or -1 if the fork failed.
+ */
+pid_t SmallShell::forkCommand(std::shared_ptr<Command> command,
+                              const RedirectionPlan &plan) {
+  std::cout.flush();
+  TraceScope scope("process", "fork", command->getName());
+  // Brought up to date here, a forked child would rebuild it every time.
+  auto block = environment.getBlock();
+  pid_t pid = -1;
+  if (fork_server.isRunning() && !launch_limits &&
+      command->kind() == CommandKind::External) {
+    // Whatever the helper can not start is forked here instead.
+    auto &external = static_cast<ExternalCommand &>(*command);
+    pid = fork_server.launch(external.getExecArgs(), block,
+                             external.getAssignments(), plan);
+  }
+  if (pid == -1) {
+    pid = fork();
+  }
+  if (pid == -1) {
+    syscallError("fork");
+    return -1;
+  }
+  scope.setArg(pid);
+
+  if (pid == 0) {
+    // Forked child
+    signal(SIGPIPE, SIG_DFL);
+    if (!applyRedirections(plan) ||
+        (launch_limits && !applyOwnLimits(*launch_limits))) {
+      exit(1);
+    }
+    command->execute(this);
+  }
+
+  // The child does the same, whichever runs first the group exists before
+  // anyone signals it. Fails harmlessly once the child already exec'd.
+  setpgid(pid, pid);
+  return pid;
+}
+
+//                                                                 //
+//------------------------Command functions------------------------//
+//                                                                 //
+Command::Command(const std::string &cmd_line,
+                 const std::string &cmd_line_stripped,
+                 bool background_command_flag)
+    : command_line(cmd_line), argv(new char *[MAX_ARGV_LENGTH]),
+      argc(_parseCommandLine(cmd_line_stripped, argv)),
+      background_command_flag(background_command_flag),
+      startTime(_monotonicNanos()), jobId(-1) {}
+
+Command::Command(const Command &other)
+    : command_line(other.command_line), argv(new char *[MAX_ARGV_LENGTH]),
+      argc(other.argc),
+      background_command_flag(other.background_command_flag),
+      startTime(_monotonicNanos()), jobId(-1) {
+  for (int i = 0; i < argc; i++) {
+    argv[i] = strdup(other.argv[i]);
+  }
+  argv[argc] = NULL;
+}
+
+Command::~Command() {
+  for (int i = 0; i < argc; i++) {
+    delete argv[i];
+    argv[i] = NULL;
+  }
+  delete[] argv;
+}
+
+const std::string Command::getCommandLine() const { return command_line; }
+const char *Command::getName() const { return argc > 0 ? argv[0] : ""; }
+uint64_t Command::getStartTime() const { return startTime; }
+int Command::getJobId() const { return jobId; }
+void Command::setJobId(int id) { jobId = id; }
+bool Command::isBackgroundCommand() const { return background_command_flag; }
+
+ChangePromptCommand::ChangePromptCommand(const std::string &cmd_line,
+                                         const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void ChangePromptCommand::execute(SmallShell *smash) {
+  if (argc == 1) {
+    smash->setDisplayPrompt("smash");
+  } else {
+    smash->setDisplayPrompt(std::string(argv[1]));
+  }
+}
 
 ShowPidCommand::ShowPidCommand(const std::string &cmd_line,
                                const std::string &cmd_line_stripped)
     : BuiltInCommand(cmd_line, cmd_line_stripped) {}
 
 void ShowPidCommand::execute(SmallShell *smash) {
-  std::cout << "smash pid is " << smash->getPid() << std::endl;
+  std::cout << "smash pid is " << smash->getPid() << '\n';
 }
 
 GetCurrDirCommand::GetCurrDirCommand(const std::string &cmd_line,
@@ -467,79 +1641,788 @@ GetCurrDirCommand::GetCurrDirCommand(const std::string &cmd_line,
 void GetCurrDirCommand::execute(SmallShell *smash) {
   char cwd[PATH_MAX];
   if (getcwd(cwd, sizeof(cwd)) != NULL) {
-    std::cout << cwd << std::endl;
+    std::cout << cwd << '\n';
   } else {
     syscallError("getcwd");
   }
 }
 
-ChangeDirCommand::ChangeDirCommand(const std::string &cmd_line,
-                                   const std::string &cmd_line_stripped)
+ChangeDirCommand::ChangeDirCommand(const std::string &cmd_line,
+                                   const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void ChangeDirCommand::execute(SmallShell *smash) {
+  if (argc > 2) {
+    std::cerr << "smash error: cd: too many arguments" << std::endl;
+    return;
+  }
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    syscallError("getcwd");
+  }
+
+  if (argc == 1) {
+    const std::string *home = smash->getEnvironment()->get("HOME");
+    if (chdir(home ? home->c_str() : "") != 0) {
+      syscallError("chdir");
+      return;
+    }
+  } else {
+    const char *target = argv[1];
+
+    // Handle cd to previous directory.
+    if (strcmp(target, "-") == 0) {
+      auto lastDir = smash->getLastDir();
+
+      if (lastDir.empty()) {
+        std::cerr << "smash error: cd: OLDPWD not set" << std::endl;
+        return;
+      } else {
+        if (chdir(lastDir.c_str()) != 0) {
+          syscallError("chdir");
+          return;
+        }
+      }
+    }
+
+    // Handle general cd.
+    else {
+      if (chdir(target) != 0) {
+        syscallError("chdir");
+        return;
+      }
+    }
+  }
+
+  smash->setLastDir(cwd);
+}
+
+JobsCommand::JobsCommand(const std::string &cmd_line,
+                         const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+bool JobsCommand::printsOnly() const {
+  return argc < 2 || strcmp(argv[1], "-f") != 0;
+}
+
+void JobsCommand::execute(SmallShell *smash) {
+  if (argc == 1) {
+    smash->getJobList()->printJobsList();
+    return;
+  }
+  if (argc == 2 && strcmp(argv[1], "-v") == 0) {
+    smash->getJobList()->printJobsList(true);
+    return;
+  }
+
+  // jobs -o <id> dumps a captured job's output, jobs -f <id> follows it.
+  int id;
+  try {
+    bool follow = argc == 3 && strcmp(argv[1], "-f") == 0;
+    if (argc != 3 || (strcmp(argv[1], "-o") != 0 && !follow)) {
+      throw std::exception();
+    }
+    id = std::stoi(argv[2]);
+    if (std::to_string(id).length() != std::string(argv[2]).length()) {
+      throw std::exception();
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "smash error: jobs: invalid arguments" << std::endl;
+    return;
+  }
+
+  auto jobs = smash->getJobList();
+  std::string output;
+  if (!jobs->getCapture()->getOutput(id, output)) {
+    std::cerr << "smash error: jobs: job-id " << id
+              << " has no captured output" << std::endl;
+    return;
+  }
+
+  std::cout << output;
+  auto job = jobs->getJobById(id);
+  if (strcmp(argv[1], "-f") == 0 && job) {
+    smash->followJobOutput(job->pid);
+  }
+}
+
+CaptureCommand::CaptureCommand(const std::string &cmd_line,
+                               const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void CaptureCommand::execute(SmallShell *smash) {
+  auto capture = smash->getJobList()->getCapture();
+  if (argc == 1) {
+    std::cout << "smash: output capture is "
+              << (capture->isEnabled() ? "on" : "off") << ", "
+              << capture->getUsedSize() << " of " << CAPTURE_TOTAL_SIZE
+              << " bytes in use" << '\n';
+  } else if (argc == 2 && strcmp(argv[1], "on") == 0) {
+    capture->setEnabled(true);
+  } else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+    capture->setEnabled(false);
+  } else {
+    std::cerr << "smash error: capture: invalid arguments" << std::endl;
+  }
+}
+
+QuitCommand::QuitCommand(const std::string &cmd_line,
+                         const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void QuitCommand::execute(SmallShell *smash) {
+  bool killJobs = argc >= 2 && std::string(argv[1]).compare("kill") == 0;
+  int graceMs = -1;
+  if (killJobs && argc >= 3 && std::string(argv[2]).compare("--grace") == 0) {
+    try {
+      if (argc < 4) {
+        throw std::exception();
+      }
+      graceMs = std::stoi(argv[3]);
+      if (graceMs < 0 ||
+          std::to_string(graceMs).length() != std::string(argv[3]).length()) {
+        throw std::exception();
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "smash error: quit: invalid arguments" << std::endl;
+      return;
+    }
+  }
+
+  smash->disableSmash();
+  smash->getHistory()->flush();
+  if (killJobs) {
+    smash->killAllJobs(graceMs);
+  }
+}
+
+SigstatsCommand::SigstatsCommand(const std::string &cmd_line,
+                                 const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void SigstatsCommand::execute(SmallShell *smash) {
+  if (argc != 1) {
+    std::cerr << "smash error: sigstats: invalid arguments" << std::endl;
+    return;
+  }
+
+  SignalStats stats = getSignalStats();
+  long long average =
+      stats.handled == 0 ? 0 : stats.total_latency / (long long)stats.handled;
+  std::cout << "signals handled: " << stats.handled << '\n';
+  std::cout << "signals dropped: " << stats.dropped << '\n';
+  std::cout << "latency: avg " << average / 1000 << " us, max "
+            << stats.max_latency / 1000 << " us" << '\n';
+}
+
+CacheCommand::CacheCommand(const std::string &cmd_line,
+                           const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void CacheCommand::execute(SmallShell *smash) {
+  auto cache = smash->getParseCache();
+  std::string action = argc > 1 ? argv[1] : "stats";
+
+  if (action == "clear" && argc == 2) {
+    cache->clear();
+  } else if (action == "size" && argc == 3) {
+    try {
+      int size = std::stoi(argv[2]);
+      if (size < 0 ||
+          std::to_string(size).length() != std::string(argv[2]).length()) {
+        throw std::exception();
+      }
+      cache->setCapacity(size);
+    } catch (const std::exception &e) {
+      std::cerr << "smash error: cache: invalid arguments" << std::endl;
+    }
+  } else if (action == "stats" && argc <= 2) {
+    unsigned long lookups = cache->getHits() + cache->getMisses();
+    std::cout << "cache: " << cache->getSize() << "/" << cache->getCapacity()
+              << " lines, " << cache->getHits() << " hits, "
+              << cache->getMisses() << " misses";
+    if (lookups > 0) {
+      std::cout << " (" << cache->getHits() * 100 / lookups << "% hit rate)";
+    }
+    std::cout << '\n';
+  } else {
+    std::cerr << "smash error: cache: invalid arguments" << std::endl;
+  }
+}
+
+TraceCommand::TraceCommand(const std::string &cmd_line,
+                           const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void TraceCommand::execute(SmallShell *smash) {
+  if (argc == 3 && std::string(argv[1]) == "start") {
+    if (traceEnabled()) {
+      std::cerr << "smash error: trace: already started" << std::endl;
+      return;
+    }
+    if (!traceStart(argv[2])) {
+      syscallError("open");
+    }
+  } else if (argc == 2 && std::string(argv[1]) == "stop") {
+    if (!traceEnabled()) {
+      std::cerr << "smash error: trace: not started" << std::endl;
+      return;
+    }
+    uint64_t dropped = traceDropped();
+    long count = traceStop();
+    if (count == -1) {
+      syscallError("write");
+      return;
+    }
+    std::cout << "smash: wrote " << count << " trace events";
+    if (dropped > 0) {
+      std::cout << ", the oldest " << dropped << " were overwritten";
+    }
+    std::cout << '\n';
+  } else {
+    std::cerr << "smash error: trace: invalid arguments" << std::endl;
+  }
+}
+
+HistoryCommand::HistoryCommand(const std::string &cmd_line,
+                               const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void HistoryCommand::execute(SmallShell *smash) {
+  std::string prefix, pattern;
+  int limit = 0;
+
+  try {
+    for (int i = 1; i < argc; i += 2) {
+      std::string flag = argv[i];
+      if (i + 1 == argc) {
+        throw std::exception();
+      }
+      std::string value = argv[i + 1];
+      if (flag == "-s") {
+        pattern = value;
+      } else if (flag == "-p") {
+        prefix = value;
+      } else if (flag == "-n") {
+        limit = std::stoi(value);
+        if (limit <= 0 || std::to_string(limit).length() != value.length()) {
+          throw std::exception();
+        }
+      } else {
+        throw std::exception();
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "smash error: history: invalid arguments" << std::endl;
+    return;
+  }
+
+  auto history = smash->getHistory();
+  for (auto number : history->search(prefix, pattern, limit)) {
+    std::cout << std::setw(5) << number + 1 << "  "
+              << history->getEntry(number) << '\n';
+  }
+}
+
+RepeatCommand::RepeatCommand(const std::string &cmd_line,
+                             const std::string &cmd_line_stripped)
+    : Command(cmd_line, cmd_line_stripped,
+              _isBackgroundComamnd(cmd_line.c_str())) {}
+
+void RepeatCommand::execute(SmallShell *smash) {
+  // In a group of its own like an external command, and without the
+  // shell's handlers, which would report to the shell.
+  if (setpgrp() != 0) {
+    syscallError("setpgrp");
+  }
+  for (int signum : {SIGINT, SIGTSTP, SIGCHLD, SIGALRM}) {
+    signal(signum, SIG_DFL);
+  }
+
+  // repeat [-n count] -i interval_ms [-q] command...
+  RepeatOptions options;
+  int i = 1;
+  try {
+    while (i < argc && argv[i][0] == '-') {
+      std::string flag = argv[i++];
+      if (flag == "-q") {
+        options.queue = true;
+        continue;
+      }
+      if ((flag != "-n" && flag != "-i") || i == argc) {
+        throw std::exception();
+      }
+      std::string value = argv[i++];
+      int number = std::stoi(value);
+      if (number <= 0 || std::to_string(number).length() != value.length()) {
+        throw std::exception();
+      }
+      (flag == "-n" ? options.count : options.interval_ms) = number;
+    }
+    if (options.interval_ms == 0 || i == argc) {
+      throw std::exception();
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "smash error: repeat: invalid arguments" << std::endl;
+    _exit(1);
+  }
+
+  // Parsed, resolved and given its environment once, only launched on
+  // every tick.
+  std::string line;
+  for (; i < argc; i++) {
+    line += std::string(argv[i]) + " ";
+  }
+  auto command = smash->CreateCommand(line);
+  if (command->kind() != CommandKind::External) {
+    std::cerr << "smash error: repeat: " << command->getName()
+              << ": not an external command" << std::endl;
+    _exit(1);
+  }
+  auto &external = static_cast<ExternalCommand &>(*command);
+  std::vector<std::string> args = external.getExecArgs();
+  auto environment = smash->getEnvironment();
+  const std::string *searchPath = environment->get("PATH");
+  std::string path = resolveCommand(args[0], searchPath ? *searchPath : "");
+  if (path.empty()) {
+    std::cerr << "smash error: repeat: " << args[0] << ": command not found"
+              << std::endl;
+    _exit(1);
+  }
+
+  auto block = environment->getBlock();
+  std::vector<char *> envp =
+      layerEnvironment(*block, external.getAssignments());
+  std::vector<char *> execArgs;
+  for (auto &&arg : args) {
+    execArgs.push_back((char *)arg.c_str());
+  }
+  execArgs.push_back(nullptr);
+  _exit(runRepeat(options, path, execArgs, envp.data()));
+}
+
+AssignmentCommand::AssignmentCommand(const std::string &cmd_line,
+                                     const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void AssignmentCommand::execute(SmallShell *smash) {
+  for (int i = 0; i < argc; i++) {
+    std::string word = argv[i];
+    size_t equals = word.find('=');
+    smash->getEnvironment()->set(word.substr(0, equals),
+                                 word.substr(equals + 1));
+  }
+}
+
+ExportCommand::ExportCommand(const std::string &cmd_line,
+                             const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void ExportCommand::execute(SmallShell *smash) {
+  auto environment = smash->getEnvironment();
+  if (argc == 1) {
+    for (auto &&entry : environment->getExported()) {
+      std::cout << "export " << entry << '\n';
+    }
+    return;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    if (!isValidName(argv[i]) && !isAssignment(argv[i])) {
+      std::cerr << "smash error: export: invalid arguments" << std::endl;
+      return;
+    }
+  }
+  for (int i = 1; i < argc; i++) {
+    std::string word = argv[i];
+    size_t equals = word.find('=');
+    std::string name = word.substr(0, equals);
+    if (equals != std::string::npos) {
+      environment->set(name, word.substr(equals + 1));
+    }
+    environment->exportName(name);
+  }
+}
+
+UnsetCommand::UnsetCommand(const std::string &cmd_line,
+                           const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+void UnsetCommand::execute(SmallShell *smash) {
+  for (int i = 1; i < argc; i++) {
+    if (!isValidName(argv[i])) {
+      std::cerr << "smash error: unset: invalid arguments" << std::endl;
+      return;
+    }
+  }
+  for (int i = 1; i < argc; i++) {
+    smash->getEnvironment()->unset(argv[i]);
+  }
+}
+
+WaitCommand::WaitCommand(const std::string &cmd_line,
+                         const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+static void _printExitStatus(int id, const char *commandLine, pid_t pid,
+                             int status) {
+  std::cout << "[" << id << "] " << commandLine << " : " << pid;
+  if (WIFSIGNALED(status)) {
+    std::cout << " killed by signal " << WTERMSIG(status) << '\n';
+  } else {
+    std::cout << " exited with status " << WEXITSTATUS(status) << '\n';
+  }
+  std::cout.flush();
+}
+
+void WaitCommand::execute(SmallShell *smash) {
+  auto jobs = smash->getJobList();
+  bool any = false;
+  int timeout = -1;
+  std::vector<int> ids;
+
+  try {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "-n") {
+        any = true;
+        continue;
+      }
+
+      if (arg == "-t") {
+        if (++i == argc) {
+          throw std::exception();
+        }
+        arg = argv[i];
+      }
+      int value = std::stoi(arg);
+      if (value < 0 || std::to_string(value).length() != arg.length()) {
+        throw std::exception();
+      }
+      if (std::string(argv[i - 1]) == "-t") {
+        timeout = value;
+      } else {
+        ids.push_back(value);
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "smash error: wait: invalid arguments" << std::endl;
+    return;
+  }
+
+  // Jobs that exited before wait ran are no longer in the list, their
+  // status was kept.
+  auto &reaped = jobs->getFinishedJobs();
+  std::vector<JobsList::JobEntry *> waited;
+  std::vector<JobsList::FinishedJob> done;
+  for (int id : ids) {
+    auto job = jobs->getJobById(id);
+    auto it = std::find_if(
+        reaped.begin(), reaped.end(),
+        [id](const JobsList::FinishedJob &entry) { return entry.id == id; });
+    if (job) {
+      waited.push_back(job);
+    } else if (it != reaped.end()) {
+      done.push_back(*it);
+    } else {
+      std::cerr << "smash error: wait: job-id " << id << " does not exist"
+                << std::endl;
+      return;
+    }
+  }
+  if (ids.empty()) {
+    waited = jobs->getAllJobs();
+    done = reaped;
+  }
+
+  // A status is only reported once, like bash's.
+  auto forget = [&](int id) {
+    auto it = std::find_if(
+        reaped.begin(), reaped.end(),
+        [id](const JobsList::FinishedJob &kept) { return kept.id == id; });
+    if (it == reaped.end()) {
+      return false;
+    }
+    reaped.erase(it);
+    return true;
+  };
+  for (auto &&entry : done) {
+    if (!forget(entry.id)) {
+      continue;
+    }
+    _printExitStatus(entry.id, entry.command_line.c_str(), entry.pid,
+                     entry.status);
+    if (any) {
+      return;
+    }
+  }
+  if (waited.empty()) {
+    return;
+  }
+
+  // The jobs are reaped by the reactor, which reports them here as they
+  // exit. Captured jobs never block on a full pipe while we wait for them.
+  std::vector<int> pending;
+  for (auto job : waited) {
+    if (job->pidfd == -1) {
+      syscallError("pidfd_open");
+      return;
+    }
+    pending.push_back(job->id);
+  }
+  size_t remaining = pending.size();
+  jobs->setExitObserver([&](const JobsList::JobEntry &job, int status) {
+    auto it = std::find(pending.begin(), pending.end(), job.id);
+    if (it == pending.end()) {
+      return;
+    }
+    pending.erase(it);
+    remaining--;
+    forget(job.id);
+    _printExitStatus(job.id, job.command_line, job.pid, status);
+  });
+
+  std::cout.flush();
+  unsigned long interrupts = smash->getInterrupts();
+  bool finished = smash->runEvents(
+      [&]() {
+        return remaining == 0 || (any && remaining < waited.size()) ||
+               smash->getInterrupts() != interrupts;
+      },
+      timeout);
+  jobs->setExitObserver(nullptr);
+
+  if (!finished && timeout != -1) {
+    std::cout << "smash: wait: timed out, " << remaining
+              << (remaining == 1 ? " job is" : " jobs are")
+              << " still running" << '\n';
+  }
+}
+
+TypeCommand::TypeCommand(const std::string &cmd_line,
+                         const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+static bool _isExecutableFile(const std::string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode) &&
+         access(path.c_str(), X_OK) == 0;
+}
+
+void TypeCommand::execute(SmallShell *smash) {
+  if (argc < 2) {
+    std::cerr << "smash error: type: invalid arguments" << std::endl;
+    return;
+  }
+
+  PathIndex *index = smash->getPathIndex();
+  for (int i = 1; i < argc; i++) {
+    std::string name = argv[i];
+    std::string path;
+    if (name.find('/') != std::string::npos) {
+      path = _isExecutableFile(name) ? name : "";
+    } else if (smash->isBuiltin(name)) {
+      std::cout << name << " is a shell builtin" << '\n';
+      continue;
+    } else {
+      path = index->find(name);
+    }
+
+    if (path.empty()) {
+      std::cerr << "smash error: type: " << name << ": not found" << std::endl;
+    } else {
+      std::cout << name << " is " << path << '\n';
+    }
+  }
+}
+
+WhichCommand::WhichCommand(const std::string &cmd_line,
+                           const std::string &cmd_line_stripped)
     : BuiltInCommand(cmd_line, cmd_line_stripped) {}
 
-void ChangeDirCommand::execute(SmallShell *smash) {
-  if (argc > 2) {
-    std::cerr << "smash error: cd: too many arguments" << std::endl;
+// which [-a] name...
+void WhichCommand::execute(SmallShell *smash) {
+  int first = 1;
+  bool all = argc > 1 && strcmp(argv[1], "-a") == 0;
+  if (all) {
+    first++;
+  }
+  if (first == argc) {
+    std::cerr << "smash error: which: invalid arguments" << std::endl;
     return;
   }
 
-  char cwd[PATH_MAX];
-  if (getcwd(cwd, sizeof(cwd)) == NULL) {
-    syscallError("getcwd");
-  }
+  // Answered from the index, the directories are not searched.
+  PathIndex *index = smash->getPathIndex();
+  for (int i = first; i < argc; i++) {
+    std::string name = argv[i];
+    std::vector<std::string> found;
+    if (name.find('/') != std::string::npos) {
+      if (_isExecutableFile(name)) {
+        found.push_back(name);
+      }
+    } else if (all) {
+      found = index->findAll(name);
+    } else if (!index->find(name).empty()) {
+      found.push_back(index->find(name));
+    }
 
-  if (argc == 1) {
-    if (chdir(getenv("HOME")) != 0) {
-      syscallError("chdir");
-      return;
+    if (found.empty()) {
+      std::cerr << "smash error: which: " << name << ": not found"
+                << std::endl;
     }
-  } else {
-    const char *target = argv[1];
+    for (auto &&path : found) {
+      std::cout << path << '\n';
+    }
+  }
+}
 
-    // Handle cd to previous directory.
-    if (strcmp(target, "-") == 0) {
-      auto lastDir = smash->getLastDir();
+DagCommand::DagCommand(const std::string &cmd_line,
+                       const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
 
-      if (lastDir.empty()) {
-        std::cerr << "smash error: cd: OLDPWD not set" << std::endl;
-        return;
-      } else {
-        if (chdir(lastDir.c_str()) != 0) {
-          syscallError("chdir");
-          return;
+static std::string _formatSeconds(uint64_t nanos) {
+  std::ostringstream text;
+  text << std::fixed << std::setprecision(3) << nanos / 1e9 << " s";
+  return text.str();
+}
+
+void DagCommand::execute(SmallShell *smash) {
+  auto jobs = smash->getJobList();
+  // No limit unless -j gives one.
+  size_t limit = 0;
+  std::string path;
+
+  try {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "-j") {
+        if (++i == argc) {
+          throw std::exception();
+        }
+        arg = argv[i];
+        int value = std::stoi(arg);
+        if (value <= 0 || std::to_string(value).length() != arg.length()) {
+          throw std::exception();
         }
+        limit = value;
+      } else if (path.empty()) {
+        path = arg;
+      } else {
+        throw std::exception();
       }
     }
-
-    // Handle general cd.
-    else {
-      if (chdir(target) != 0) {
-        syscallError("chdir");
-        return;
-      }
+    if (path.empty()) {
+      throw std::exception();
     }
+  } catch (const std::exception &e) {
+    std::cerr << "smash error: dag: invalid arguments" << std::endl;
+    return;
   }
 
-  smash->setLastDir(cwd);
-}
+  std::ifstream file(path);
+  if (!file) {
+    syscallError("open");
+    return;
+  }
+  TaskGraph graph;
+  std::string error;
+  if (!graph.parse(file, error)) {
+    std::cerr << "smash error: dag: " << error << std::endl;
+    return;
+  }
 
-JobsCommand::JobsCommand(const std::string &cmd_line,
-                         const std::string &cmd_line_stripped)
-    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
-void JobsCommand::execute(SmallShell *smash) {
-  smash->getJobList()->printJobsList();
-}
+  // Tasks are reported as they exit, by job id. The reactor wakes up the
+  // moment a pidfd is readable, and the dependents start right after.
+  std::map<int, size_t> running;
+  unsigned long finished = 0;
+  auto report = [&](size_t index, bool ok, const std::string &how) {
+    const DagTask &task = graph.getTask(index);
+    std::vector<size_t> skipped = graph.finish(index, ok, _monotonicNanos());
+    finished++;
+    std::cout << "smash: dag: " << task.name << " " << how;
+    if (task.end_time != task.start_time) {
+      std::cout << " after " << _formatSeconds(task.end_time - task.start_time);
+    }
+    std::cout << '\n';
+    for (size_t next : skipped) {
+      std::cout << "smash: dag: " << graph.getTask(next).name
+                << " skipped, " << task.name << " failed" << '\n';
+    }
+  };
+  jobs->setExitObserver([&](const JobsList::JobEntry &job, int status) {
+    auto it = running.find(job.id);
+    if (it == running.end()) {
+      return;
+    }
+    size_t index = it->second;
+    running.erase(it);
+    if (WIFSIGNALED(status)) {
+      report(index, false, "killed by signal " +
+                               std::to_string(WTERMSIG(status)));
+    } else if (WEXITSTATUS(status) != 0) {
+      report(index, false, "failed with status " +
+                               std::to_string(WEXITSTATUS(status)));
+    } else {
+      report(index, true, "done");
+    }
+  });
+
+  uint64_t start = _monotonicNanos();
+  unsigned long interrupts = smash->getInterrupts();
+  bool interrupted = false;
+  while (true) {
+    // Ready tasks start in the order of the file, a task that can not be
+    // started fails like any other.
+    while (graph.hasReady() && (limit == 0 || running.size() < limit)) {
+      size_t index = graph.popReady();
+      uint64_t now = _monotonicNanos();
+      int id = smash->startJob(graph.getTask(index).command);
+      if (id == -1) {
+        report(index, false, "could not be started");
+        continue;
+      }
+      graph.start(index, now);
+      running[id] = index;
+    }
+    if (running.empty()) {
+      break;
+    }
 
-QuitCommand::QuitCommand(const std::string &cmd_line,
-                         const std::string &cmd_line_stripped)
-    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+    std::cout.flush();
+    unsigned long seen = finished;
+    smash->runEvents([&]() {
+      return finished != seen || smash->getInterrupts() != interrupts;
+    });
+    if (smash->getInterrupts() != interrupts) {
+      interrupted = true;
+      break;
+    }
+  }
+  jobs->setExitObserver(nullptr);
+  uint64_t wall = _monotonicNanos() - start;
 
-void QuitCommand::execute(SmallShell *smash) {
-  smash->disableSmash();
-  if (argc >= 2 && std::string(argv[1]).compare("kill") == 0) {
-    smash->killAllJobs();
+  if (interrupted) {
+    std::cout << "smash: dag: interrupted, " << running.size()
+              << (running.size() == 1 ? " task is" : " tasks are")
+              << " still running in the background" << '\n';
+  }
+  std::cout << "smash: dag: " << graph.size() << " tasks, "
+            << graph.count(DagTask::State::Done) << " done, "
+            << graph.count(DagTask::State::Failed) << " failed, "
+            << graph.count(DagTask::State::Skipped) << " skipped" << '\n';
+
+  std::vector<size_t> chain;
+  uint64_t critical = graph.criticalPath(chain);
+  if (!chain.empty()) {
+    std::cout << "smash: dag: critical path " << _formatSeconds(critical)
+              << ":";
+    for (size_t i = 0; i < chain.size(); i++) {
+      std::cout << (i == 0 ? " " : " -> ") << graph.getTask(chain[i]).name;
+    }
+    std::cout << '\n';
   }
-  // kill the jobs
+  std::cout << "smash: dag: wall time " << _formatSeconds(wall) << '\n';
 }
 
 ForegroundCommand::ForegroundCommand(const std::string &cmd_line,
@@ -578,10 +2461,14 @@ void ForegroundCommand::execute(SmallShell *smash) {
   }
 
   job->state = JobsList::JobState::Running;
-  std::cout << job->command->getCommandLine() << " : " << job->pid << std::endl;
+  std::cout << job->command_line << " : " << job->pid << '\n';
+  std::cout.flush();
 
   auto pid = job->pid;
-  auto command = job->command;
+  // The job's line lives in the list's arena, it is released with the job.
+  std::string commandLine = job->command_line;
+  uint64_t startTime = job->start_time;
+  int jobId = job->id;
 
   auto jobs = smash->getJobList();
   jobs->removeJobById(job->id);
@@ -593,15 +2480,17 @@ void ForegroundCommand::execute(SmallShell *smash) {
   smash->setCurrentCommandPid(pid);
   smash->setCurrentCommand(this);
   int waitStatus;
-  if (waitpid(pid, &waitStatus, WUNTRACED) == -1) {
+  if (!smash->waitForeground(pid, &waitStatus)) {
     syscallError("waitpid");
   }
   smash->setCurrentCommandPid(-1);
   smash->setCurrentCommand(nullptr);
 
   if (WIFSTOPPED(waitStatus)) {
-    jobs->addJob(command, pid, true);
-    std::cout << "smash: process " << pid << " was stopped" << std::endl;
+    jobs->addJob(commandLine, startTime, jobId, pid, true);
+    std::cout << "smash: process " << pid << " was stopped" << '\n';
+  } else {
+    jobs->getCapture()->detach(pid);
   }
 }
 
@@ -649,8 +2538,8 @@ void BackgroundCommand::execute(SmallShell *smash) {
     return;
   }
 
-  job->state = JobsList::JobState::Running;
-  std::cout << job->command->getCommandLine() << " : " << job->pid << std::endl;
+  smash->getJobList()->setJobsState({job}, JobsList::JobState::Running);
+  std::cout << job->command_line << " : " << job->pid << '\n';
 
   if (kill(job->pid, SIGCONT) == -1) {
     syscallError("kill");
@@ -665,50 +2554,147 @@ void KillCommand::execute(SmallShell *smash) {
     return;
   }
 
-  int signum, jobid;
+  int signum;
+  std::vector<JobsList::JobEntry *> jobs;
 
   try {
     signum = sigNumParser();
-    jobid = std::stoi(argv[2]);
-    if (signum <= 0 || signum > 31 ||
-        std::to_string(jobid).length() != (std::string(argv[2]).length())) {
+    if (signum <= 0 || signum > 31) {
       throw std::exception();
     }
+    jobs = jobsParser(smash, argv[2]);
+  } catch (const JobNotFound &e) {
+    std::cerr << "smash error: kill: job-id " << e.id << " does not exist"
+              << std::endl;
+    return;
   } catch (const std::exception &e) {
     std::cerr << "smash error: kill: invalid arguments" << std::endl;
     return;
   }
 
-  JobsList::JobEntry *job_to_sig = smash->getJobList()->getJobById(jobid);
-  if (!job_to_sig || job_to_sig->state == JobsList::JobState::Killed) {
-    std::cerr << "smash error: kill: job-id " << jobid << " does not exist"
-              << std::endl;
+  for (auto job : jobs) {
+    // A pidfd keeps naming the job even after its pid was reused.
+    int res = job->pidfd != -1
+                  ? (int)syscall(SYS_pidfd_send_signal, job->pidfd, signum,
+                                 nullptr, 0)
+                  : kill(job->pid, signum);
+    if (res == -1) {
+      syscallError(job->pidfd != -1 ? "pidfd_send_signal" : "kill");
+    }
+    std::cout << "signal number " << signum << " was sent to pid " << job->pid
+              << '\n';
+  }
+
+  JobsList::JobState state;
+  if (signum == SIGCONT) {
+    state = JobsList::JobState::Running;
+  } else if (signum == SIGSTOP) {
+    state = JobsList::JobState::Stopped;
+  } else if (signum == SIGKILL) {
+    state = JobsList::JobState::Killed;
+  } else {
     return;
   }
+  smash->getJobList()->setJobsState(jobs, state);
+}
 
-  if (kill(job_to_sig->pid, signum) == -1) {
-    syscallError("kill");
+/**
+ * Selects the jobs named by spec: "all", "stopped", or a comma separated
+ * list of job ids and id ranges like "3-40". Ranges only select the jobs that
+ * exist, single ids must exist. Each job is selected once, in id order.
+ */
+std::vector<JobsList::JobEntry *>
+KillCommand::jobsParser(SmallShell *smash, const std::string &spec) const {
+  auto all = smash->getJobList()->getAllJobs();
+  if (spec == "all" || spec == "stopped") {
+    std::vector<JobsList::JobEntry *> selected;
+    for (auto job : all) {
+      if (job->state == JobsList::JobState::Killed) {
+        continue;
+      }
+      if (spec == "all" || job->state == JobsList::JobState::Stopped) {
+        selected.push_back(job);
+      }
+    }
+    return selected;
   }
-  std::cout << "signal number " << signum << " was sent to pid "
-            << job_to_sig->pid << std::endl;
 
-  if (signum == SIGCONT) {
-    job_to_sig->state = JobsList::JobState::Running;
+  std::vector<std::pair<int, int>> ranges;
+  std::stringstream items(spec);
+  std::string item;
+  while (std::getline(items, item, ',')) {
+    auto dash = item.find('-', 1);
+    std::string first = item.substr(0, dash);
+    std::string last =
+        dash == std::string::npos ? first : item.substr(dash + 1);
+    int from = std::stoi(first);
+    int to = std::stoi(last);
+    if (std::to_string(from).length() != first.length() ||
+        std::to_string(to).length() != last.length() || from > to) {
+      throw std::exception();
+    }
+    ranges.push_back(std::make_pair(from, to));
   }
-  if (signum == SIGSTOP) {
-    job_to_sig->state = JobsList::JobState::Stopped;
+  if (ranges.empty() || spec.back() == ',') {
+    throw std::exception();
+  }
+
+  // One pass over the jobs, which are sorted by id.
+  std::vector<JobsList::JobEntry *> selected;
+  std::vector<bool> found(ranges.size(), false);
+  for (auto job : all) {
+    if (job->state == JobsList::JobState::Killed) {
+      continue;
+    }
+    bool matched = false;
+    for (size_t i = 0; i < ranges.size(); i++) {
+      if (ranges[i].first <= job->id && job->id <= ranges[i].second) {
+        found[i] = matched = true;
+      }
+    }
+    if (matched) {
+      selected.push_back(job);
+    }
   }
-  if (signum == SIGKILL) {
-    job_to_sig->state = JobsList::JobState::Killed;
+
+  for (size_t i = 0; i < ranges.size(); i++) {
+    if (!found[i] && ranges[i].first == ranges[i].second) {
+      throw JobNotFound(ranges[i].first);
+    }
   }
+  return selected;
 }
 
+static const struct {
+  const char *name;
+  int number;
+} SIGNAL_NAMES[] = {
+    {"HUP", SIGHUP},       {"INT", SIGINT},   {"QUIT", SIGQUIT},
+    {"ILL", SIGILL},       {"TRAP", SIGTRAP}, {"ABRT", SIGABRT},
+    {"BUS", SIGBUS},       {"FPE", SIGFPE},   {"KILL", SIGKILL},
+    {"USR1", SIGUSR1},     {"SEGV", SIGSEGV}, {"USR2", SIGUSR2},
+    {"PIPE", SIGPIPE},     {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+    {"CHLD", SIGCHLD},     {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP},     {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU},
+    {"URG", SIGURG},       {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ},
+    {"VTALRM", SIGVTALRM}, {"PROF", SIGPROF}, {"WINCH", SIGWINCH},
+    {"IO", SIGIO},         {"PWR", SIGPWR},   {"SYS", SIGSYS},
+};
+
 int KillCommand::sigNumParser() const {
   std::string s = argv[1];
   if (s[0] != '-') {
     throw std::exception();
   }
   s.erase(0, 1);
+  // Symbolic names, with or without the SIG prefix.
+  std::string name = s.compare(0, 3, "SIG") == 0 ? s.substr(3) : s;
+  for (auto &&signal : SIGNAL_NAMES) {
+    if (name == signal.name) {
+      return signal.number;
+    }
+  }
+
   int id = std::stoi(s);
   if (std::to_string(id).length() != (std::string(argv[1]).length() - 1)) {
     throw std::exception();
@@ -772,6 +2758,64 @@ void SetcoreCommand::execute(SmallShell *smash) {
   }
 }
 
+LimitCommand::LimitCommand(const std::string &cmd_line,
+                           const std::string &cmd_line_stripped)
+    : BuiltInCommand(cmd_line, cmd_line_stripped) {}
+
+/**
+ * limit <job-id> <options> changes a running job, limit <options> <command>
+ * starts the command with them. The options are --nice, --ioprio, --as,
+ * --cpu and --nofile.
+ */
+void LimitCommand::execute(SmallShell *smash) {
+  ResourceLimits limits;
+  int jobId = -1;
+  int index = 1;
+
+  try {
+    if (argc > 1 && argv[1][0] != '-') {
+      jobId = std::stoi(argv[1]);
+      if (std::to_string(jobId).length() != std::string(argv[1]).length()) {
+        throw std::exception();
+      }
+      index = 2;
+    }
+
+    while (index < argc && parseLimitOption(argv, argc, index, limits)) {
+    }
+    bool hasLimits =
+        limits.has_nice || limits.has_ioprio || !limits.rlimits.empty();
+    bool hasCommand = index < argc;
+    if (!hasLimits || hasCommand == (jobId != -1)) {
+      throw std::exception();
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "smash error: limit: invalid arguments" << std::endl;
+    return;
+  }
+
+  if (jobId == -1) {
+    std::string commandLine = argv[index];
+    for (int i = index + 1; i < argc; i++) {
+      commandLine += std::string(" ") + argv[i];
+    }
+    if (_isBackgroundComamnd(command_line.c_str())) {
+      commandLine += "&";
+    }
+    smash->runLimited(commandLine, limits);
+    return;
+  }
+
+  JobsList::JobEntry *job = smash->getJobList()->getJobById(jobId);
+  if (!job) {
+    std::cerr << "smash error: limit: job-id " << jobId << " does not exist"
+              << std::endl;
+    return;
+  }
+  // Every job leads a process group of its own.
+  applyGroupLimits(job->pid, limits);
+}
+
 FareCommand::FareCommand(const std::string &cmd_line,
                          const std::string &cmd_line_stripped)
     : BuiltInCommand(cmd_line, cmd_line_stripped) {}
@@ -811,7 +2855,7 @@ void FareCommand::execute(SmallShell *smash) {
   }
 
   std::cout << "replaced " << counter << " instances of the string \"" << source
-            << "\"" << std::endl;
+            << "\"" << '\n';
 
   std::ofstream file(argv[1]);
   file << contents;
@@ -819,8 +2863,12 @@ void FareCommand::execute(SmallShell *smash) {
 
 ExternalCommand::ExternalCommand(const std::string &cmd_line,
                                  const std::string &cmd_line_stripped,
-                                 bool background_command_flag)
-    : Command(cmd_line, cmd_line_stripped, background_command_flag) {}
+                                 bool background_command_flag,
+                                 const std::vector<std::string> &assignments,
+                                 const std::string &command_text)
+    : Command(cmd_line, cmd_line_stripped, background_command_flag),
+      command_text(command_text.empty() ? cmd_line_stripped : command_text),
+      assignments(assignments) {}
 
 void ExternalCommand::execute(SmallShell *smash) {
   // First change group ID to prevent shell signals from being received.
@@ -828,107 +2876,357 @@ void ExternalCommand::execute(SmallShell *smash) {
     syscallError("setpgrp");
   }
 
+  traceInstant("process", "exec", 0, getName());
+
+  // The shared block as it is, unless VAR=value words change it.
+  auto block = smash->getEnvironment()->getBlock();
+  char *const *envp = block->envp.data();
+  std::vector<char *> layered;
+  if (!assignments.empty()) {
+    layered = layerEnvironment(*block, assignments);
+    envp = layered.data();
+  }
+  // execvpe looks the command up in the PATH of environ, not of envp.
+  environ = (char **)envp;
+
   // Check if complex external command or regular.
-  if (command_line.find('*') != std::string::npos ||
-      command_line.find('?') != std::string::npos) {
-    if (execl("/bin/bash", "/bin/bash", "-c", command_line.c_str(), nullptr) !=
-        0) {
+  if (needsBash()) {
+    if (execle("/bin/bash", "/bin/bash", "-c", command_text.c_str(), nullptr,
+               envp) != 0) {
       syscallError("execl");
       exit(1);
     };
   } else {
-    if (execvp(argv[0], argv) != 0) {
+    if (execvpe(argv[0], argv, envp) != 0) {
       syscallError("execvp");
       exit(1);
     };
   }
 }
 
+bool ExternalCommand::needsBash() const {
+  return command_text.find('*') != std::string::npos ||
+         command_text.find('?') != std::string::npos;
+}
+
+const std::vector<std::string> &ExternalCommand::getAssignments() const {
+  return assignments;
+}
+
+std::vector<std::string> ExternalCommand::getExecArgs() const {
+  if (needsBash()) {
+    return {"/bin/bash", "-c", command_text};
+  }
+  return std::vector<std::string>(argv, argv + argc);
+}
+
 //                                                                 //
 //------------------------JobList functions------------------------//
 //                                                                 //
 std::ostream &operator<<(std::ostream &os, const JobsList::JobEntry &job) {
-  auto now = time(nullptr);
-  int delta = (int)difftime(now, job.command->getStartTime());
+  int delta = (int)((_monotonicNanos() - job.start_time) / 1000000000);
 
-  os << "[" << job.id << "] " << job.command->getCommandLine() << " : "
+  os << "[" << job.id << "] " << job.command_line << " : "
      << job.pid << " " << delta << " secs"
      << (job.state == JobsList::JobState::Stopped ? " (stopped)" : "");
 
   return os;
 }
 
-void JobsList::addJob(std::shared_ptr<Command> cmd, pid_t pid, bool isStopped) {
+JobsList::JobEntry::JobEntry(const char *command_line, uint64_t start_time,
+                             int id, pid_t pid, JobState state)
+    : command_line(command_line), start_time(start_time), id(id), pid(pid),
+      state(state), pidfd(_pidfdOpen(pid)) {}
+
+JobsList::JobEntry::~JobEntry() {
+  if (pidfd != -1) {
+    close(pidfd);
+  }
+}
+
+int JobsList::addJob(std::shared_ptr<Command> cmd, pid_t pid, bool isStopped) {
+  int id = addJob(cmd->getCommandLine(), cmd->getStartTime(), cmd->getJobId(),
+                  pid, isStopped);
+  cmd->setJobId(id);
+  return id;
+}
+
+int JobsList::addJob(const std::string &commandLine, uint64_t startTime,
+                     int id, pid_t pid, bool isStopped) {
   removeFinishedJobs();
-  if (cmd->getJobId() == -1) {
-    cmd->setJobId(getFreeID());
+  if (id == -1) {
+    id = getFreeID();
   }
-  auto job = std::make_shared<JobEntry>(cmd, cmd->getJobId(), pid,
-                                        isStopped ? JobState::Stopped
-                                                  : JobState::Running);
+  // wait <id> means the new job from now on.
+  finished_jobs.erase(std::remove_if(finished_jobs.begin(),
+                                     finished_jobs.end(),
+                                     [id](const FinishedJob &finished) {
+                                       return finished.id == id;
+                                     }),
+                      finished_jobs.end());
 
   // Keep the list sorted.
   auto it = jobs.begin();
-  while (it != jobs.end() && (*it)->id < job->id) {
+  while (it != jobs.end() && it->id < id) {
+    ++it;
+  }
+
+  auto job = jobs.emplace(it, arena.intern(commandLine), startTime, id, pid,
+                          isStopped ? JobState::Stopped : JobState::Running);
+  needs_scan = true;
+  publishJob(*job);
+  if (reactor && job->pidfd != -1) {
+    reactor->add(job->pidfd, EPOLLIN, [this, pid](uint32_t) { reapJob(pid); });
+  }
+  return id;
+}
+
+void JobsList::setReactor(Reactor *reactor) { this->reactor = reactor; }
+
+void JobsList::setExitObserver(ExitObserver observer) {
+  exit_observer = std::move(observer);
+}
+
+std::vector<JobsList::FinishedJob> &JobsList::getFinishedJobs() {
+  return finished_jobs;
+}
+
+void JobsList::keepFinishedJob(const JobEntry &job, int status) {
+  if (finished_jobs.size() == JOBS_MAX_FINISHED) {
+    finished_jobs.erase(finished_jobs.begin());
+  }
+  finished_jobs.push_back({job.id, job.pid, job.command_line, status});
+}
+
+/**
+ * Called by the reactor once the job's pidfd is readable, which it only
+ * becomes when the job exited.
+ */
+void JobsList::reapJob(pid_t pid) {
+  auto it = jobs.begin();
+  while (it != jobs.end() && it->pid != pid) {
     ++it;
   }
+  if (it == jobs.end()) {
+    return;
+  }
+
+  int waitStatus = 0;
+  int res = waitpid(pid, &waitStatus, WNOHANG);
+  if (res == 0) {
+    return;
+  }
+  if (res > 0) {
+    traceInstant("process", "reap", pid);
+  }
+  capture.detach(pid);
+  if (res > 0) {
+    keepFinishedJob(*it, waitStatus);
+  }
+  if (res > 0 && exit_observer) {
+    exit_observer(*it, waitStatus);
+  }
+  eraseJob(it);
+}
 
-  jobs.insert(it, job);
+void JobsList::eraseJob(std::list<JobEntry>::iterator it) {
+  unpublishJob(*it);
+  if (reactor && it->pidfd != -1) {
+    reactor->remove(it->pidfd);
+  }
+  jobs.erase(it);
 }
 
-void JobsList::printJobsList() {
-  // TODO: mask alarm signal when travesing joblist.
+/**
+ * Lists the jobs, verbose adds the priorities and limits each one runs with.
+ */
+void JobsList::printJobsList(bool verbose) {
   removeFinishedJobs();
 
   for (auto &&job : jobs) {
-    std::cout << (*job) << std::endl;
+    std::cout << job << '\n';
+    std::string limits = verbose ? describeLimits(job.pid) : "";
+    if (!limits.empty()) {
+      std::cout << "    " << limits << '\n';
+    }
   }
 }
 
-void JobsList::killAllJobs() {
-  // TODO: mask alarm signal when travesing joblist.
+/**
+ * Signals every job's process group at once, then reaps them as they exit.
+ * With a grace period the jobs get SIGTERM first and only the ones still
+ * alive when it ends are killed.
+ */
+void JobsList::killAllJobs(int graceMs) {
+  long start = _monotonicMillis();
   auto size = jobs.size();
-  std::cout << "smash: sending SIGKILL signal to " << size
-            << " jobs:" << std::endl;
+  int signal = graceMs == -1 ? SIGKILL : SIGTERM;
+  std::cout << "smash: sending " << (signal == SIGKILL ? "SIGKILL" : "SIGTERM")
+            << " signal to " << size << " jobs";
+  if (graceMs != -1) {
+    std::cout << " (SIGKILL after " << graceMs << " ms)";
+  }
+  std::cout << ":" << '\n';
+  std::vector<JobEntry *> pending;
   for (auto &&job : jobs) {
-    if (kill(job->pid, SIGKILL) == -1) {
-      syscallError("kill");
-    } else {
-      std::cout << job->pid << ": " << job->command->getCommandLine()
-                << std::endl;
+    if (killpg(job.pid, signal) == -1) {
+      syscallError("killpg");
+      continue;
     }
-    if (waitpid(job->pid, nullptr, 0) == -1) {
-      syscallError("waitpid");
+    if (job.state == JobState::Stopped && signal != SIGKILL) {
+      // A stopped job could not act on SIGTERM.
+      killpg(job.pid, SIGCONT);
+    }
+    std::cout << job.pid << ": " << job.command_line << '\n';
+    pending.push_back(&job);
+  }
+  std::cout.flush();
+
+  if (graceMs != -1) {
+    reapJobs(pending, graceMs);
+    for (auto job : pending) {
+      if (killpg(job->pid, SIGKILL) == -1) {
+        syscallError("killpg");
+      }
     }
   }
+  reapJobs(pending, -1);
+
+  for (auto &&job : jobs) {
+    capture.detach(job.pid);
+    arena.release(job.command_line);
+    if (reactor && job.pidfd != -1) {
+      reactor->remove(job.pidfd);
+    }
+    traceInstant("job", "removed", job.id, nullptr);
+  }
   jobs.clear();
+  table.clear();
+
+  if (graceMs != -1) {
+    std::cout << "smash: shut down " << size << " jobs in "
+              << _monotonicMillis() - start << " ms" << '\n';
+  }
+}
+
+/**
+ * Reaps the pending jobs in whatever order they exit, until all of them are
+ * gone or timeoutMs passes (-1 waits for all). Reaped jobs are removed from
+ * pending.
+ */
+void JobsList::reapJobs(std::vector<JobEntry *> &pending, int timeoutMs) {
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd == -1) {
+    syscallError("epoll_create1");
+  }
+
+  // Jobs without a pidfd are checked every few milliseconds instead.
+  bool polling = epollFd == -1;
+  for (auto job : pending) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = job;
+    if (epollFd == -1 || job->pidfd == -1 ||
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, job->pidfd, &event) == -1) {
+      polling = true;
+    }
+  }
+
+  auto reap = [&](JobEntry *job) {
+    if (waitpid(job->pid, nullptr, WNOHANG) == 0) {
+      return false;
+    }
+    traceInstant("process", "reap", job->pid);
+    if (job->pidfd != -1 && epollFd != -1) {
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, job->pidfd, nullptr);
+    }
+    return true;
+  };
+  // Whatever already exited does not need to wait for an event.
+  pending.erase(std::remove_if(pending.begin(), pending.end(), reap),
+                pending.end());
+
+  long deadline = _monotonicMillis() + timeoutMs;
+  while (!pending.empty()) {
+    int left = -1;
+    if (timeoutMs != -1) {
+      left = std::max(deadline - _monotonicMillis(), 0L);
+      if (left == 0) {
+        break;
+      }
+    }
+    if (polling && (left == -1 || left > 10)) {
+      left = 10;
+    }
+
+    struct epoll_event events[64];
+    int count = 0;
+    if (epollFd != -1) {
+      count = epoll_wait(epollFd, events, 64, left);
+    } else {
+      poll(nullptr, 0, left);
+    }
+
+    if (polling) {
+      pending.erase(std::remove_if(pending.begin(), pending.end(), reap),
+                    pending.end());
+      continue;
+    }
+    for (int i = 0; i < count; i++) {
+      auto job = (JobEntry *)events[i].data.ptr;
+      if (reap(job)) {
+        pending.erase(std::find(pending.begin(), pending.end(), job));
+      }
+    }
+  }
+
+  if (epollFd != -1) {
+    close(epollFd);
+  }
 }
 
 void JobsList::removeFinishedJobs() {
-  // TODO: mask alarm signal when travesing joblist.
+  // Nothing could have finished unless a SIGCHLD arrived since the last scan.
+  bool changed = takeChildChanged();
+  if (!changed && !needs_scan) {
+    return;
+  }
+  needs_scan = false;
 
   auto it = jobs.begin();
   while (it != jobs.end()) {
-    auto job = *it;
+    JobEntry *job = &*it;
     if (job->state == JobState::Killed) {
-      auto current = it++;
-      jobs.erase(current);
+      capture.detach(job->pid);
+      eraseJob(it++);
 
       continue;
     }
 
     int waitStatus;
     int res = waitpid(job->pid, &waitStatus, WNOHANG);
+    if (res > 0 && (WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus))) {
+      traceInstant("process", "reap", job->pid);
+    }
 
-    if (res == -1 || (res > 0 && WIFEXITED(waitStatus))) {
-      auto current = it++;
-      jobs.erase(current);
+    if (res == -1 ||
+        (res > 0 && (WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus)))) {
+      capture.detach(job->pid);
+      if (res > 0) {
+        keepFinishedJob(*job, waitStatus);
+      }
+      if (res > 0 && exit_observer) {
+        exit_observer(*job, waitStatus);
+      }
+      eraseJob(it++);
     } else if (WIFSTOPPED(waitStatus)) {
       auto current = it++;
-      current->get()->state = JobState::Stopped;
+      current->state = JobState::Stopped;
+      publishJob(*job);
     } else if (WIFCONTINUED(waitStatus)) {
       auto current = it++;
-      current->get()->state = JobState::Running;
+      current->state = JobState::Running;
+      publishJob(*job);
     } else {
       ++it;
     }
@@ -936,53 +3234,45 @@ void JobsList::removeFinishedJobs() {
 }
 
 JobsList::JobEntry *JobsList::getJobById(int jobId) {
-  // TODO: mask alarm signal when travesing joblist.
   for (auto &&job : jobs) {
-    if (job->id == jobId) {
-      return job.get();
+    if (job.id == jobId) {
+      return &job;
     }
   }
 
   return nullptr;
 }
 JobsList::JobEntry *JobsList::getJobByPid(pid_t jobPid) {
-  // TODO: mask alarm signal when travesing joblist.
   for (auto &&job : jobs) {
-    if (job->pid == jobPid) {
-      return job.get();
+    if (job.pid == jobPid) {
+      return &job;
     }
   }
 
   return nullptr;
 }
 void JobsList::removeJobById(int jobId) {
-  // TODO: mask alarm signal when travesing joblist.
   auto it = jobs.begin();
-  while (it != jobs.end() && (*it)->id != jobId) {
+  while (it != jobs.end() && it->id != jobId) {
     ++it;
   }
 
   if (it != jobs.end()) {
-    jobs.erase(it);
+    eraseJob(it);
   }
 }
 
 JobsList::JobEntry *JobsList::getLastJob() {
-  // TODO: mask alarm signal when travesing joblist.
-
   if (jobs.empty()) {
     return nullptr;
   }
 
-  auto lastJob = jobs.back();
-  return lastJob.get();
+  return &jobs.back();
 }
 
 JobsList::JobEntry *JobsList::getLastStoppedJob() {
-  // TODO: mask alarm signal when travesing joblist.
-
   auto it = jobs.rbegin();
-  while (it != jobs.rend() && (*it)->state != JobState::Stopped) {
+  while (it != jobs.rend() && it->state != JobState::Stopped) {
     ++it;
   }
 
@@ -990,15 +3280,61 @@ JobsList::JobEntry *JobsList::getLastStoppedJob() {
     return nullptr;
   }
 
-  return it->get();
+  return &*it;
 }
 
-int JobsList::getFreeID() const {
-  // TODO: mask alarm signal when travesing joblist.
+void JobsList::setJobsState(const std::vector<JobEntry *> &selected,
+                            JobState state) {
+  for (auto job : selected) {
+    job->state = state;
+    publishJob(*job);
+  }
+  // Killed jobs are dropped on the next scan, even before their SIGCHLD.
+  if (state == JobState::Killed && !selected.empty()) {
+    needs_scan = true;
+  }
+}
+
+OutputCapture *JobsList::getCapture() { return &capture; }
+
+JobTable *JobsList::getTable() { return &table; }
+
+std::vector<JobsList::JobEntry *> JobsList::getAllJobs() {
+  std::vector<JobEntry *> all;
+  for (auto &&job : jobs) {
+    all.push_back(&job);
+  }
+  return all;
+}
+
+void JobsList::publishJob(const JobEntry &job) {
+  JobTableState state = JOB_TABLE_RUNNING;
+  if (job.state == JobState::Stopped) {
+    state = JOB_TABLE_STOPPED;
+  } else if (job.state == JobState::Killed) {
+    state = JOB_TABLE_KILLED;
+  }
+  // The table is read by other processes, so it gets the wall clock time.
+  time_t startTime =
+      time(nullptr) - (_monotonicNanos() - job.start_time) / 1000000000;
+  table.publish(job.id, job.pid, state, startTime, job.command_line);
+  traceInstant("job",
+               state == JOB_TABLE_RUNNING   ? "running"
+               : state == JOB_TABLE_STOPPED ? "stopped"
+                                            : "killed",
+               job.id, job.command_line);
+}
+
+void JobsList::unpublishJob(const JobEntry &job) {
+  table.remove(job.id);
+  arena.release(job.command_line);
+  traceInstant("job", "removed", job.id, nullptr);
+}
 
+int JobsList::getFreeID() const {
   if (jobs.empty()) {
     return 1;
   }
 
-  return jobs.back()->id + 1;
+  return jobs.back().id + 1;
 }
\ No newline at end of file
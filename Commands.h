@@ -1,6 +1,20 @@
 #ifndef SMASH_COMMAND_H_
 #define SMASH_COMMAND_H_
 
+#include "arena.h"
+#include "capture.h"
+#include "environment.h"
+#include "forkserver.h"
+#include "history.h"
+#include "joblimits.h"
+#include "jobtable.h"
+#include "lru_cache.h"
+#include "output.h"
+#include "pathindex.h"
+#include "reactor.h"
+#include "redirection.h"
+#include "timing.h"
+#include <functional>
 #include <list>
 #include <memory>
 #include <string>
@@ -9,25 +23,41 @@
 #define COMMAND_ARGS_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
 #define MAX_ARGV_LENGTH (2 * COMMAND_MAX_ARGS + 5)
+#define JOBS_MAX_FINISHED (100)
 
 class SmallShell;
 
+void syscallError(const std::string &syscall);
+// The shell-style status of a waitpid status: the exit code, or 128 plus
+// the signal that killed or stopped the process.
+int exitStatus(int waitStatus);
+
+// Tells apart what runs inside smash from what needs a fork, without RTTI.
+// Forked ones are builtins that run in a child of their own, as a job.
+enum class CommandKind { BuiltIn, External, Forked };
+
 class Command {
 protected:
   const std::string command_line;
   char **argv;
   const int argc;
   bool background_command_flag;
-  time_t startTime;
+  uint64_t startTime; // CLOCK_MONOTONIC nanoseconds.
   int jobId;
   // TODO: Add your data members
 public:
   Command(const std::string &cmd_line, const std::string &cmd_line_stripped,
           bool background_command_flag);
+  Command(const Command &other);
   virtual ~Command();
   virtual void execute(SmallShell *smash) = 0;
+  virtual CommandKind kind() const = 0;
+  // Whether running it only writes to std::cout, so $(...) can run it
+  // without a fork or a pipe.
+  virtual bool printsOnly() const { return false; }
   const std::string getCommandLine() const;
-  const time_t &getStartTime() const;
+  const char *getName() const;
+  uint64_t getStartTime() const;
   bool isBackgroundCommand() const;
   int getJobId() const;
   void setJobId(int id);
@@ -36,12 +66,30 @@ public:
   // TODO: Add your extra methods if needed
 };
 
+// What the $NAME, ${NAME} and $(...) of a line expanded to, in order.
+// While the line is parsed each of them is a placeholder, so nothing a
+// value holds is ever read as an operator, values only end up in words,
+// redirection targets and here-documents.
+typedef std::vector<std::string> Expansions;
+
+// Makes a fresh copy of a command, with its own start time and job id.
+typedef std::shared_ptr<Command> (*CommandCloner)(const Command &command);
+
+// One command of a parsed line: the command that is copied for every run of
+// the line, and where its fds go.
+struct ParsedCommand {
+  std::shared_ptr<Command> prototype;
+  CommandCloner clone;
+  RedirectionPlan plan;
+};
+
 class BuiltInCommand : public Command {
 public:
   BuiltInCommand(const std::string &cmd_line,
                  const std::string &cmd_line_stripped)
       : Command(cmd_line, cmd_line_stripped, false) {}
   virtual ~BuiltInCommand() {}
+  CommandKind kind() const override { return CommandKind::BuiltIn; }
 };
 
 class ChangePromptCommand : public BuiltInCommand {
@@ -53,12 +101,25 @@ public:
 };
 
 class ExternalCommand : public Command {
+  // The command without its redirections, for lines bash has to expand.
+  // Expanded words are quoted in it, bash only expands what was typed.
+  const std::string command_text;
+  // The VAR=value words before the command, set for it alone.
+  const std::vector<std::string> assignments;
+  bool needsBash() const;
+
 public:
   ExternalCommand(const std::string &cmd_line,
                   const std::string &cmd_line_stripped,
-                  bool background_command_flag);
+                  bool background_command_flag,
+                  const std::vector<std::string> &assignments = {},
+                  const std::string &command_text = "");
   virtual ~ExternalCommand() {}
   void execute(SmallShell *smash) override;
+  CommandKind kind() const override { return CommandKind::External; }
+  // What execute() runs, bash for lines with wildcards.
+  std::vector<std::string> getExecArgs() const;
+  const std::vector<std::string> &getAssignments() const;
 };
 
 class PipeCommand : public Command {
@@ -97,6 +158,7 @@ public:
                     const std::string &cmd_line_stripped);
   virtual ~GetCurrDirCommand() {}
   void execute(SmallShell *smash) override;
+  bool printsOnly() const override { return true; }
 };
 
 class ShowPidCommand : public BuiltInCommand {
@@ -105,6 +167,7 @@ public:
                  const std::string &cmd_line_stripped);
   virtual ~ShowPidCommand() {}
   void execute(SmallShell *smash) override;
+  bool printsOnly() const override { return true; }
 };
 
 class JobsList;
@@ -120,35 +183,77 @@ public:
 class JobsList {
 public:
   enum class JobState { Running, Stopped, Killed };
+  // A job only keeps what is needed to list and signal it, the command it
+  // runs is freed once launched.
   struct JobEntry {
-    JobEntry(std::shared_ptr<Command> command, int id, pid_t pid,
-             JobState state)
-        : command(command), id(id), pid(pid), state(state) {}
-
-    std::shared_ptr<Command> command;
+    JobEntry(const char *command_line, uint64_t start_time, int id, pid_t pid,
+             JobState state);
+    ~JobEntry();
+    JobEntry(JobEntry const &) = delete;       // disable copy ctor
+    void operator=(JobEntry const &) = delete; // disable = operator
+
+    const char *command_line; // Interned in the arena of the list.
+    uint64_t start_time;      // CLOCK_MONOTONIC nanoseconds.
     int id;
     pid_t pid;
     JobState state;
+    int pidfd; // Readable once the job exits, -1 if pidfds are unsupported.
 
     friend std::ostream &operator<<(std::ostream &os, const JobEntry &job);
   };
 
 public:
-  void addJob(std::shared_ptr<Command> cmd, pid_t pid, bool isStopped);
-  void printJobsList();
-  void killAllJobs();
+  // Both return the id of the job, a new one unless the command already had
+  // an id (-1 for none).
+  int addJob(std::shared_ptr<Command> cmd, pid_t pid, bool isStopped);
+  int addJob(const std::string &commandLine, uint64_t startTime, int id,
+             pid_t pid, bool isStopped);
+  // Jobs are reaped by the reactor as soon as their pidfd says they exited.
+  void setReactor(Reactor *reactor);
+  // Called with every job that is reaped, and its waitpid status.
+  typedef std::function<void(const JobEntry &job, int status)> ExitObserver;
+  void setExitObserver(ExitObserver observer);
+  // A job that was reaped, kept until wait reports it or a new job takes
+  // its id, so wait can still report a job that exited before it ran.
+  struct FinishedJob {
+    int id;
+    pid_t pid;
+    std::string command_line;
+    int status; // As waitpid returned it.
+  };
+  std::vector<FinishedJob> &getFinishedJobs();
+  void printJobsList(bool verbose = false);
+  void killAllJobs(int graceMs = -1);
   void removeFinishedJobs();
   JobEntry *getJobById(int jobId);
   void removeJobById(int jobId);
   JobEntry *getLastJob();
   JobEntry *getLastStoppedJob();
   JobEntry *getJobByPid(pid_t jobPid);
+  OutputCapture *getCapture();
+  JobTable *getTable();
+  std::vector<JobEntry *> getAllJobs();
+  void setJobsState(const std::vector<JobEntry *> &selected, JobState state);
 
   // TODO: Add extra methods or modify exisitng ones as needed
 
 private:
   int getFreeID() const;
-  std::list<std::shared_ptr<JobEntry>> jobs;
+  void reapJobs(std::vector<JobEntry *> &pending, int timeoutMs);
+  void publishJob(const JobEntry &job);
+  void unpublishJob(const JobEntry &job);
+  void reapJob(pid_t pid);
+  void keepFinishedJob(const JobEntry &job, int status);
+  void eraseJob(std::list<JobEntry>::iterator it);
+  std::list<JobEntry> jobs;
+  StringArena arena;
+  Reactor *reactor = nullptr;
+  ExitObserver exit_observer;
+  std::vector<FinishedJob> finished_jobs;
+  // A job added after the last scan may have exited before it was added.
+  bool needs_scan = false;
+  OutputCapture capture;
+  JobTable table;
 };
 
 class JobsCommand : public BuiltInCommand {
@@ -158,6 +263,131 @@ public:
               const std::string &cmd_line_stripped);
   virtual ~JobsCommand() {}
   void execute(SmallShell *smash) override;
+  // jobs -f echoes the job's output straight to fd 1.
+  bool printsOnly() const override;
+};
+
+class CaptureCommand : public BuiltInCommand {
+public:
+  CaptureCommand(const std::string &cmd_line,
+                 const std::string &cmd_line_stripped);
+  virtual ~CaptureCommand() {}
+  void execute(SmallShell *smash) override;
+};
+
+class SigstatsCommand : public BuiltInCommand {
+public:
+  SigstatsCommand(const std::string &cmd_line,
+                  const std::string &cmd_line_stripped);
+  virtual ~SigstatsCommand() {}
+  void execute(SmallShell *smash) override;
+  bool printsOnly() const override { return true; }
+};
+
+class CacheCommand : public BuiltInCommand {
+public:
+  CacheCommand(const std::string &cmd_line,
+               const std::string &cmd_line_stripped);
+  virtual ~CacheCommand() {}
+  void execute(SmallShell *smash) override;
+};
+
+class LimitCommand : public BuiltInCommand {
+public:
+  LimitCommand(const std::string &cmd_line,
+               const std::string &cmd_line_stripped);
+  virtual ~LimitCommand() {}
+  void execute(SmallShell *smash) override;
+};
+
+class TraceCommand : public BuiltInCommand {
+public:
+  TraceCommand(const std::string &cmd_line,
+               const std::string &cmd_line_stripped);
+  virtual ~TraceCommand() {}
+  void execute(SmallShell *smash) override;
+};
+
+class HistoryCommand : public BuiltInCommand {
+public:
+  HistoryCommand(const std::string &cmd_line,
+                 const std::string &cmd_line_stripped);
+  virtual ~HistoryCommand() {}
+  void execute(SmallShell *smash) override;
+  bool printsOnly() const override { return true; }
+};
+
+// A line of NAME=value words only, which sets shell variables.
+class AssignmentCommand : public BuiltInCommand {
+public:
+  AssignmentCommand(const std::string &cmd_line,
+                    const std::string &cmd_line_stripped);
+  virtual ~AssignmentCommand() {}
+  void execute(SmallShell *smash) override;
+};
+
+class ExportCommand : public BuiltInCommand {
+public:
+  ExportCommand(const std::string &cmd_line,
+                const std::string &cmd_line_stripped);
+  virtual ~ExportCommand() {}
+  void execute(SmallShell *smash) override;
+  bool printsOnly() const override { return argc == 1; }
+};
+
+class UnsetCommand : public BuiltInCommand {
+public:
+  UnsetCommand(const std::string &cmd_line,
+               const std::string &cmd_line_stripped);
+  virtual ~UnsetCommand() {}
+  void execute(SmallShell *smash) override;
+};
+
+class WaitCommand : public BuiltInCommand {
+public:
+  WaitCommand(const std::string &cmd_line,
+              const std::string &cmd_line_stripped);
+  virtual ~WaitCommand() {}
+  void execute(SmallShell *smash) override;
+};
+
+// Runs the tasks of a dag file as background jobs, each as soon as its
+// dependencies are done and at most -j at a time.
+class DagCommand : public BuiltInCommand {
+public:
+  DagCommand(const std::string &cmd_line,
+             const std::string &cmd_line_stripped);
+  virtual ~DagCommand() {}
+  void execute(SmallShell *smash) override;
+};
+
+class TypeCommand : public BuiltInCommand {
+public:
+  TypeCommand(const std::string &cmd_line,
+              const std::string &cmd_line_stripped);
+  virtual ~TypeCommand() {}
+  void execute(SmallShell *smash) override;
+  bool printsOnly() const override { return true; }
+};
+
+class WhichCommand : public BuiltInCommand {
+public:
+  WhichCommand(const std::string &cmd_line,
+               const std::string &cmd_line_stripped);
+  virtual ~WhichCommand() {}
+  void execute(SmallShell *smash) override;
+  bool printsOnly() const override { return true; }
+};
+
+// Runs in a forked child, so it can be a job: stopped, resumed and killed
+// like any other.
+class RepeatCommand : public Command {
+public:
+  RepeatCommand(const std::string &cmd_line,
+                const std::string &cmd_line_stripped);
+  virtual ~RepeatCommand() {}
+  void execute(SmallShell *smash) override;
+  CommandKind kind() const override { return CommandKind::Forked; }
 };
 
 class ForegroundCommand : public BuiltInCommand {
@@ -204,12 +434,18 @@ public:
 
 class KillCommand : public BuiltInCommand {
   /* Bonus */
-  // TODO: Add your data members
+  struct JobNotFound : std::exception {
+    explicit JobNotFound(int id) : id(id) {}
+    int id;
+  };
+
 public:
   KillCommand(const std::string &cmd_line,
               const std::string &cmd_line_stripped);
   virtual ~KillCommand() {}
   int sigNumParser() const;
+  std::vector<JobsList::JobEntry *> jobsParser(SmallShell *smash,
+                                               const std::string &spec) const;
   void execute(SmallShell *smash) override;
 };
 
@@ -218,33 +454,89 @@ private:
   enum class CommandType {
     Regular,
     Redirect,
-    RedirectAppend,
     Pipe,
     PipeErr,
   };
 
+public:
+  // Everything parsing a command line produces, cached by the exact line
+  // unless it has expansions.
+  struct ParsedLine {
+    CommandType type;
+    ParsedCommand commands[2];
+  };
+
 private:
   const std::string default_display_prompt;
   const pid_t smash_pid;
   std::string current_display_prompt;
   std::string last_dir;
   bool is_working;
+  Reactor reactor;
+  PathIndex path_index;
   JobsList jobs;
   Command *current_command = nullptr;
   pid_t current_command_pid = -1;
+  int last_status = 0;
+  FdOutputBuffer output_buffer;
+  std::streambuf *original_output;
+  LruCache<ParsedLine> parse_cache;
+  History history;
+  // Applied by forked commands before they run, set by limit.
+  const ResourceLimits *launch_limits = nullptr;
+  ForkServer fork_server;
+  Environment environment;
+  // Where reaped processes are added while a time prefix runs.
+  TimedUsage *timed_usage = nullptr;
+  // The job whose captured output is echoed while the reactor runs.
+  pid_t echo_pid = -1;
+  // How many times processSignalEvents ran, and how many of those had a
+  // ctrl-C or ctrl-Z, which interrupt waits.
+  unsigned long signal_rounds = 0;
+  unsigned long interrupts = 0;
 
   SmallShell();
 
   CommandType checkType(const std::string &cmd_line) const;
+  pid_t runLine(const char *cmd_line, bool detach);
+  pid_t dispatchCommand(const char *cmd_line, bool detach);
+  bool lookupLine(const char *cmd_line, ParsedLine &outLine);
+  pid_t runParsed(ParsedLine &parsed, bool detach);
+  bool parseLine(const std::string &cmd_line, ParsedLine &outLine,
+                 const Expansions *expansions = nullptr);
+  bool expandLine(const std::string &cmd_line, std::string &outLine,
+                  Expansions &outExpansions);
+  bool captureOutput(const std::string &cmd_line, std::string &outOutput);
+  bool readForeground(pid_t pid, int fd, std::string &outOutput,
+                      int *status);
+  void runTimed(const std::string &cmd_line);
+  pid_t waitChild(pid_t pid, int *status, int options);
+  pid_t runCommand(std::shared_ptr<Command> command, RedirectionPlan &plan,
+                   bool detach);
+  void runPipe(std::shared_ptr<Command> command1, RedirectionPlan &plan1,
+               std::shared_ptr<Command> command2, RedirectionPlan &plan2,
+               bool errPipe);
+  bool openTeeFiles(const std::vector<std::string> &paths,
+                    std::vector<int> &outFds);
+  void closeTeeFiles(std::vector<int> &fds);
+  bool openTeePipe(int teePipe[2]);
+  bool waitForEvents(pid_t echoPid, const std::function<bool()> &done,
+                     bool interruptible);
+  void watchCapture();
+  pid_t forkCommand(std::shared_ptr<Command> command,
+                    const RedirectionPlan &plan);
 
 public:
   std::shared_ptr<Command> CreateCommand(const std::string &cmd_line);
-  void CreateRedirectCommand(const std::string &cmd_line,
-                             std::shared_ptr<Command> &outCommand,
-                             std::string &outFileName);
-  void CreatePipeCommand(const std::string &cmd_line,
-                         std::shared_ptr<Command> &outCommand1,
-                         std::shared_ptr<Command> &outCommand2);
+  bool CreateRedirectCommand(const std::string &cmd_line,
+                             ParsedCommand &outCommand,
+                             std::string *bodies = nullptr,
+                             const Expansions *expansions = nullptr);
+  bool CreatePipeCommand(const std::string &cmd_line,
+                         ParsedCommand &outCommand1,
+                         ParsedCommand &outCommand2,
+                         std::string *bodies = nullptr,
+                         const Expansions *expansions = nullptr);
   SmallShell(SmallShell const &) = delete;     // disable copy ctor
   void operator=(SmallShell const &) = delete; // disable = operator
   static SmallShell &getInstance()             // make SmallShell singleton
@@ -255,6 +547,17 @@ public:
   }
   ~SmallShell();
   void executeCommand(const char *cmd_line);
+  pid_t startCommand(const char *cmd_line);
+  int startJob(const std::string &cmd_line);
+  void runLimited(const std::string &cmd_line, const ResourceLimits &limits);
+  int getLastStatus() const;
+  void waitForInput();
+  // Runs the reactor until done() returns true. Returns false if timeoutMs
+  // passed first or epoll failed.
+  bool runEvents(const std::function<bool()> &done, int timeoutMs = -1);
+  unsigned long getInterrupts() const;
+  bool waitForeground(pid_t pid, int *status);
+  bool followJobOutput(pid_t pid);
   void setDisplayPrompt(std::string new_display_line);
   void setLastDir(const std::string &last_dir);
 
@@ -264,11 +567,19 @@ public:
 
   bool isSmashWorking() const;
   void disableSmash();
-  void killAllJobs();
+  void killAllJobs(int graceMs = -1);
 
-  void stopCurrentCommand();
-  void killCurrentCommand();
+  bool processSignalEvents();
+  void handleAlarm(pid_t pid);
   JobsList *getJobList();
+  Reactor *getReactor();
+  PathIndex *getPathIndex();
+  std::vector<std::string> completeWord(const std::string &word,
+                                        bool command);
+  bool isBuiltin(const std::string &name) const;
+  LruCache<ParsedLine> *getParseCache();
+  History *getHistory();
+  Environment *getEnvironment();
   Command *getCurrentCommand() const;
   pid_t getCurrentCommandPid() const;
   void setCurrentCommandPid(pid_t pid);
@@ -0,0 +1,116 @@
+#include "arena.h"
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+size_t StringArena::TextHash::operator()(const char *text) const {
+  // FNV-1a
+  size_t hash = 14695981039346656037ULL;
+  for (; *text; text++) {
+    hash = (hash ^ (unsigned char)*text) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool StringArena::TextEqual::operator()(const char *a, const char *b) const {
+  return strcmp(a, b) == 0;
+}
+
+StringArena::StringArena() : block(0), position(0) {}
+
+StringArena::~StringArena() {
+  for (auto &&data : blocks) {
+    free(data.data);
+  }
+}
+
+/**
+ * The index of the free list for strings of size bytes, and the size of
+ * their slots in outSlot.
+ */
+size_t StringArena::slotClass(size_t size, size_t &outSlot) {
+  size_t index = 0;
+  outSlot = STRING_ARENA_MIN_SLOT;
+  while (outSlot < size) {
+    outSlot <<= 1;
+    index++;
+  }
+  return index;
+}
+
+const char *StringArena::intern(const std::string &text) {
+  auto it = references.find(text.c_str());
+  if (it != references.end()) {
+    it->second++;
+    return it->first;
+  }
+
+  size_t slot;
+  size_t index = slotClass(text.length() + 1, slot);
+  if (index < free_slots.size() && free_slots[index]) {
+    char *stored = free_slots[index];
+    memcpy(&free_slots[index], stored, sizeof(char *));
+    memcpy(stored, text.c_str(), text.length() + 1);
+    references.emplace(stored, 1);
+    return stored;
+  }
+
+  size_t size = slot;
+  // Moves on to the next block, allocated or grown as needed. Past the one
+  // being filled, the blocks only hold released strings.
+  if (blocks.empty() || position + size > blocks[block].size) {
+    if (!blocks.empty()) {
+      block++;
+    }
+    position = 0;
+    if (block == blocks.size()) {
+      blocks.push_back({nullptr, 0});
+    }
+    if (blocks[block].size < size) {
+      size_t capacity = std::max<size_t>(size, STRING_ARENA_BLOCK_SIZE);
+      char *data = (char *)realloc(blocks[block].data, capacity);
+      if (!data) {
+        throw std::bad_alloc();
+      }
+      blocks[block] = {data, capacity};
+    }
+  }
+
+  char *stored = blocks[block].data + position;
+  memcpy(stored, text.c_str(), text.length() + 1);
+  position += size;
+  references.emplace(stored, 1);
+  return stored;
+}
+
+void StringArena::release(const char *text) {
+  auto it = references.find(text);
+  if (it == references.end() || --it->second > 0) {
+    return;
+  }
+  char *stored = const_cast<char *>(it->first);
+  references.erase(it);
+  if (references.empty()) {
+    block = 0;
+    position = 0;
+    free_slots.clear();
+    return;
+  }
+
+  size_t slot;
+  size_t index = slotClass(strlen(stored) + 1, slot);
+  if (index >= free_slots.size()) {
+    free_slots.resize(index + 1, nullptr);
+  }
+  memcpy(stored, &free_slots[index], sizeof(char *));
+  free_slots[index] = stored;
+}
+
+size_t StringArena::getCapacity() const {
+  size_t capacity = 0;
+  for (auto &&data : blocks) {
+    capacity += data.size;
+  }
+  return capacity;
+}
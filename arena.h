@@ -0,0 +1,58 @@
+#ifndef SMASH_ARENA_H_
+#define SMASH_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define STRING_ARENA_BLOCK_SIZE (64 * 1024)
+#define STRING_ARENA_MIN_SLOT (16)
+
+// Interned strings for records that live long, like jobs. Each distinct
+// string is stored once, packed into large blocks instead of allocated on
+// its own, and counts how many records refer to it. Every string takes a
+// slot of a power of two bytes, and a released slot goes on a free list
+// for its size, where the next string of that size finds it, so one
+// record that lives on never keeps the others' space. Once no string is
+// referred to anymore, the blocks are reused from the start. A string
+// longer than a block grows the block it goes in.
+class StringArena {
+public:
+  StringArena();
+  ~StringArena();
+  StringArena(StringArena const &) = delete;    // disable copy ctor
+  void operator=(StringArena const &) = delete; // disable = operator
+
+  // Returns the stored copy of text, valid until it is released as often
+  // as it was interned.
+  const char *intern(const std::string &text);
+  void release(const char *text);
+  // Bytes held by the blocks.
+  size_t getCapacity() const;
+
+private:
+  struct TextHash {
+    size_t operator()(const char *text) const;
+  };
+  struct TextEqual {
+    bool operator()(const char *a, const char *b) const;
+  };
+
+  struct Block {
+    char *data;
+    size_t size;
+  };
+
+  static size_t slotClass(size_t size, size_t &outSlot);
+
+  std::vector<Block> blocks;
+  size_t block;    // The block being filled.
+  size_t position; // Where the next string goes in it.
+  // The first free slot of each size, each one holds the next.
+  std::vector<char *> free_slots;
+  std::unordered_map<const char *, uint32_t, TextHash, TextEqual> references;
+};
+
+#endif // SMASH_ARENA_H_
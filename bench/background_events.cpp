@@ -0,0 +1,85 @@
+// Measures how late background events are handled while a foreground
+// command runs.
+//
+// usage: bench_background_events [jobs] [spacing_ms]
+//
+// Background jobs are forked to exit at known CLOCK_MONOTONIC times while
+// the shell waits for a foreground sleep that outlasts all of them. Each
+// job's pidfd is watched on the shell's reactor next to the job list's own,
+// and its latency is the time from the planned exit to the handler. Results
+// go to stderr.
+#include "Commands.h"
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static uint64_t monotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 20;
+  int spacingMs = argc > 2 ? atoi(argv[2]) : 50;
+  setenv("SMASH_HISTORY", "/dev/null", 1);
+
+  SmallShell &smash = SmallShell::getInstance();
+  Reactor *reactor = smash.getReactor();
+  uint64_t start = monotonicNanos() + 200000000ULL;
+  std::vector<uint64_t> latencies;
+  std::vector<int> pidfds;
+  for (int i = 0; i < count; i++) {
+    uint64_t exitTime = start + (uint64_t)i * spacingMs * 1000000ULL;
+    pid_t child = fork();
+    if (child == 0) {
+      struct timespec at = {(time_t)(exitTime / 1000000000ULL),
+                            (long)(exitTime % 1000000000ULL)};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, nullptr);
+      _exit(0);
+    }
+    smash.getJobList()->addJob("sleep " + std::to_string(i) + "&",
+                               monotonicNanos(), -1, child, false);
+
+    int pidfd = (int)syscall(SYS_pidfd_open, child, 0);
+    pidfds.push_back(pidfd);
+    reactor->add(pidfd, EPOLLIN, [&, pidfd, exitTime](uint32_t) {
+      latencies.push_back(monotonicNanos() - exitTime);
+      reactor->remove(pidfd);
+    });
+  }
+
+  // Outlasts the last job by half a second.
+  double seconds = 0.7 + count * spacingMs / 1000.0;
+  std::string line = "sleep " + std::to_string(seconds);
+  smash.executeCommand(line.c_str());
+  size_t left = smash.getJobList()->getAllJobs().size();
+
+  std::sort(latencies.begin(), latencies.end());
+  uint64_t total = 0;
+  for (uint64_t latency : latencies) {
+    total += latency;
+  }
+  std::cerr << count << " background exits during a " << seconds
+            << " s foreground command: " << latencies.size()
+            << " handled before it returned, " << left
+            << " jobs left in the list" << std::endl;
+  if (!latencies.empty()) {
+    std::cerr << "latency from exit to handler: avg "
+              << total / latencies.size() / 1000 << " us, median "
+              << latencies[latencies.size() / 2] / 1000 << " us, max "
+              << latencies.back() / 1000 << " us" << std::endl;
+  }
+
+  for (int pidfd : pidfds) {
+    close(pidfd);
+  }
+  return 0;
+}
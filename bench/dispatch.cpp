@@ -0,0 +1,46 @@
+// Times how long smash takes to turn a command line into a Command, for
+// builtin and external names, then how much the parse cache saves when the
+// same lines are executed over and over.
+//
+// usage: bench_dispatch [iterations]
+#include "Commands.h"
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+  const char *lines[] = {"bg",    "chprompt hello", "jobs", "showpid",
+                         "wait",  "ls -l /tmp",     "sleep 10&",
+                         "grep -r pattern ."};
+
+  SmallShell &smash = SmallShell::getInstance();
+  for (auto line : lines) {
+    int externals = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+      auto command = smash.CreateCommand(line);
+      externals += command->kind() == CommandKind::External;
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cerr << line << ": " << elapsed.count() / iterations << " ns"
+              << (externals ? " (external)" : "") << std::endl;
+  }
+  const char *repeated[] = {"chprompt smash", "cd .", "capture on"};
+  for (size_t capacity : {0, LRU_CACHE_DEFAULT_SIZE}) {
+    smash.getParseCache()->setCapacity(capacity);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+      smash.executeCommand(repeated[i % 3]);
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cerr << "repeated builtins, cache size " << capacity << ": "
+              << elapsed.count() / iterations << " ns" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Times what preparing the environment costs a launch: the shared block when
+// nothing changed, a rebuild after every change, and VAR=value overrides
+// layered on the block. Then launches commands through the shell and counts
+// how often the block was built.
+//
+// usage: bench_environment [iterations] [launches]
+#include "Commands.h"
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static double _nanos(Clock::time_point start, int iterations) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() /
+         iterations;
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  int launches = argc > 2 ? atoi(argv[2]) : 1000;
+
+  Environment environment;
+  for (int i = 0; i < 50; i++) {
+    environment.set("BENCH_" + std::to_string(i), std::string(40, 'x'));
+    environment.exportName("BENCH_" + std::to_string(i));
+  }
+  size_t size = environment.getBlock()->entries.size();
+
+  auto start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    environment.getBlock();
+  }
+  std::cerr << size << " variables, unchanged block: "
+            << _nanos(start, iterations) << " ns" << std::endl;
+
+  start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    environment.set("BENCH_0", std::to_string(i));
+    environment.getBlock();
+  }
+  std::cerr << "rebuilt block: " << _nanos(start, iterations) << " ns"
+            << std::endl;
+
+  std::vector<std::string> overrides = {"BENCH_1=override"};
+  auto block = environment.getBlock();
+  start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    layerEnvironment(*block, overrides);
+  }
+  std::cerr << "one override layered: " << _nanos(start, iterations) << " ns"
+            << std::endl;
+
+  setenv("SMASH_HISTORY", "/dev/null", 1);
+  SmallShell &smash = SmallShell::getInstance();
+  uint64_t builds = smash.getEnvironment()->getBuilds();
+  start = Clock::now();
+  for (int i = 0; i < launches; i++) {
+    pid_t pid =
+        smash.startCommand(i % 2 ? "/bin/true" : "BENCH=1 /bin/true");
+    waitpid(pid, nullptr, 0);
+  }
+  std::cerr << launches << " launches: " << _nanos(start, launches) / 1000
+            << " us each, block built "
+            << smash.getEnvironment()->getBuilds() - builds << " times"
+            << std::endl;
+  return 0;
+}
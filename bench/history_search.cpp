@@ -0,0 +1,75 @@
+// Times the history on a file of a million entries: opening it, building the
+// index on the first search, and then prefix and substring searches.
+//
+// usage: bench_history [file] [entries]
+//
+// The file is (re)generated with a mix of repeated and unique commands.
+#include "history.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+
+typedef std::chrono::steady_clock Clock;
+
+static double _micros(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+int main(int argc, char *argv[]) {
+  std::string path = argc > 1 ? argv[1] : "/tmp/smash_history_bench";
+  int count = argc > 2 ? atoi(argv[2]) : 1000000;
+
+  {
+    std::ofstream file(path, std::ios::trunc);
+    for (int i = 0; i < count; i++) {
+      switch (i % 4) {
+      case 0:
+        file << "ls -l /var/log/dir" << i % 1000 << '\n';
+        break;
+      case 1:
+        file << "grep -r pattern" << i % 5000 << " src\n";
+        break;
+      case 2:
+        file << "make -j4\n";
+        break;
+      default:
+        file << "echo unique entry number " << i << '\n';
+      }
+    }
+  }
+
+  auto start = Clock::now();
+  History history;
+  history.open(path);
+  std::cerr << "open: " << _micros(start) << " us" << std::endl;
+
+  start = Clock::now();
+  history.search("make", "", 1);
+  std::cerr << "first search (builds the index): " << _micros(start) / 1000
+            << " ms" << std::endl;
+
+  struct {
+    const char *prefix;
+    const char *pattern;
+    size_t limit;
+  } queries[] = {
+      {"grep -r pattern42", "", 10}, {"ls -l", "", 10},
+      {"", "dir99", 10},             {"", "number 99999", 0},
+      {"", "pattern4999 ", 0},       {"ls", "log/dir7", 20},
+  };
+  for (auto &&query : queries) {
+    const int rounds = 100;
+    size_t found = 0;
+    start = Clock::now();
+    for (int i = 0; i < rounds; i++) {
+      found = history.search(query.prefix, query.pattern, query.limit).size();
+    }
+    std::cerr << "-p \"" << query.prefix << "\" -s \"" << query.pattern
+              << "\" -n " << query.limit << ": " << _micros(start) / rounds
+              << " us, " << found << " entries" << std::endl;
+  }
+  return 0;
+}
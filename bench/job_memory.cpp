@@ -0,0 +1,101 @@
+// Measures the heap kept by the job list for each background job.
+//
+// usage: bench_job_memory [jobs]
+//
+// All the jobs share a single sleeping child, so the list can be made as big
+// as needed without running out of processes. Every job gets a command line
+// of its own, then the same number of jobs is added again with one line
+// shared by all of them. Before that, one job stays while rounds of jobs
+// come and go, like a long sleep& in a shell that keeps running commands:
+// the heap must not grow with the rounds, the bench fails if it does.
+// Results go to stderr.
+#include "Commands.h"
+#include "arena.h"
+#include <iostream>
+#include <malloc.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static size_t heapInUse() {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static void measure(SmallShell &smash, pid_t child, int count, bool distinct,
+                    const char *label) {
+  JobsList *jobs = smash.getJobList();
+  size_t before = heapInUse();
+  for (int i = 0; i < count; i++) {
+    std::string line = "sleep 100 --label job" +
+                       std::to_string(distinct ? i : 0) + "&";
+    jobs->addJob(smash.CreateCommand(line.c_str()), child, false);
+  }
+  size_t after = heapInUse();
+  std::cerr << label << ": " << count << " jobs, "
+            << (after - before) / count << " bytes per job" << std::endl;
+
+  for (auto job : jobs->getAllJobs()) {
+    jobs->removeJobById(job->id);
+  }
+}
+
+#define PINNED_ROUNDS (10)
+
+static bool measurePinned(SmallShell &smash, pid_t child, int count) {
+  JobsList *jobs = smash.getJobList();
+  int pinned = jobs->addJob(smash.CreateCommand("sleep 100 --label pinned&"),
+                            child, false);
+  size_t before = 0;
+  for (int round = 0; round < PINNED_ROUNDS; round++) {
+    for (int i = 0; i < count / PINNED_ROUNDS; i++) {
+      std::string line = "sleep 100 --label round" + std::to_string(round) +
+                         "-job" + std::to_string(i) + "&";
+      jobs->addJob(smash.CreateCommand(line.c_str()), child, false);
+    }
+    for (auto job : jobs->getAllJobs()) {
+      if (job->id != pinned) {
+        jobs->removeJobById(job->id);
+      }
+    }
+    // The first round sizes everything, the others must fit in it.
+    if (round == 0) {
+      before = heapInUse();
+    }
+  }
+  size_t after = heapInUse();
+  jobs->removeJobById(pinned);
+
+  size_t growth = after > before ? after - before : 0;
+  std::cerr << "one job pinned: " << PINNED_ROUNDS << " rounds of "
+            << count / PINNED_ROUNDS << " jobs, heap grew by " << growth
+            << " bytes after the first" << std::endl;
+  return growth < STRING_ARENA_BLOCK_SIZE;
+}
+
+int main(int argc, char *argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 10000;
+
+  pid_t child = fork();
+  if (child == 0) {
+    pause();
+    _exit(0);
+  }
+
+  SmallShell &smash = SmallShell::getInstance();
+  // First, so the blocks the other runs leave behind do not hide growth.
+  bool ok = measurePinned(smash, child, count);
+  measure(smash, child, count, true, "distinct lines");
+  measure(smash, child, count, false, "shared line");
+
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+  if (!ok) {
+    std::cerr << "the pinned job kept the space of the jobs that went"
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
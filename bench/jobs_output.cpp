@@ -0,0 +1,53 @@
+// Counts the write(2) calls made by the jobs builtin for a large job list.
+//
+// usage: bench_jobs_output [jobs] > /dev/null
+//
+// All the jobs share a single sleeping child, so the list can be made as big
+// as needed without running out of processes. Results go to stderr.
+#include "Commands.h"
+#include <fstream>
+#include <iostream>
+#include <signal.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static long readSyscw() {
+  std::ifstream io("/proc/self/io");
+  std::string key;
+  long value;
+  while (io >> key >> value) {
+    if (key == "syscw:") {
+      return value;
+    }
+  }
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 10000;
+
+  pid_t child = fork();
+  if (child == 0) {
+    pause();
+    _exit(0);
+  }
+
+  SmallShell &smash = SmallShell::getInstance();
+  for (int i = 0; i < count; i++) {
+    smash.getJobList()->addJob(smash.CreateCommand("sleep 100&"), child,
+                               false);
+  }
+
+  long before = readSyscw();
+  smash.executeCommand("jobs");
+  long after = readSyscw();
+
+  std::cerr << "jobs with " << count << " entries: " << (after - before)
+            << " write syscalls" << std::endl;
+
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+  return 0;
+}
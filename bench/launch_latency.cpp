@@ -0,0 +1,67 @@
+// Times how long starting an external command takes as the shell's memory
+// grows, with commands forked by the shell and with the fork server. Each
+// mode runs in a process of its own, the fork server is picked when the
+// shell is created.
+//
+// usage: bench_launch [launches] [max MB]
+#include "Commands.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#define CHUNK_SIZE (64 << 20)
+
+static void runMode(bool forkServer, int launches, int maxMb) {
+  setenv("SMASH_FORK_SERVER", forkServer ? "1" : "0", 1);
+  setenv("SMASH_HISTORY", "/dev/null", 1);
+  SmallShell &smash = SmallShell::getInstance();
+
+  std::vector<char *> ballast;
+  for (int mb = 0; mb <= maxMb; mb = mb == 0 ? 256 : mb * 2) {
+    // Touched, so every page is mapped and has to be copied by a fork.
+    while ((int)ballast.size() * (CHUNK_SIZE >> 20) < mb) {
+      char *chunk = (char *)malloc(CHUNK_SIZE);
+      memset(chunk, 1, CHUNK_SIZE);
+      ballast.push_back(chunk);
+    }
+
+    std::vector<double> times;
+    for (int i = 0; i < launches; i++) {
+      auto start = std::chrono::steady_clock::now();
+      pid_t pid = smash.startCommand("/bin/true");
+      std::chrono::duration<double, std::micro> elapsed =
+          std::chrono::steady_clock::now() - start;
+      times.push_back(elapsed.count());
+      waitpid(pid, nullptr, 0);
+    }
+
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (double time : times) {
+      total += time;
+    }
+    std::cerr << (forkServer ? "fork server" : "fork       ") << " rss +"
+              << mb << " MB: avg " << total / launches << " us, p99 "
+              << times[launches * 99 / 100] << " us" << std::endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int launches = argc > 1 ? atoi(argv[1]) : 200;
+  int maxMb = argc > 2 ? atoi(argv[2]) : 2048;
+
+  for (bool forkServer : {false, true}) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      runMode(forkServer, launches, maxMb);
+      _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+// Load test for smash --listen: runs concurrent clients that each send
+// requests one after the other, waiting for every reply, and reports the
+// requests per second the shell answered.
+//
+// usage: bench_listen <socket> [clients] [requests] [command]
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Reads one "<status> <length>\n<output>" reply, false on error.
+static bool readReply(int fd, std::string &buffer) {
+  char chunk[4096];
+  while (true) {
+    size_t end = buffer.find('\n');
+    if (end != std::string::npos) {
+      size_t length = strtoul(buffer.c_str() + buffer.find(' ') + 1,
+                              nullptr, 10);
+      if (buffer.size() >= end + 1 + length) {
+        buffer.erase(0, end + 1 + length);
+        return true;
+      }
+    }
+
+    ssize_t res = read(fd, chunk, sizeof(chunk));
+    if (res <= 0) {
+      return false;
+    }
+    buffer.append(chunk, res);
+  }
+}
+
+static int runClient(const char *path, int requests,
+                     const std::string &command) {
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1 ||
+      connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+    perror("connect");
+    return 1;
+  }
+
+  std::string line = command + "\n";
+  std::string buffer;
+  for (int i = 0; i < requests; i++) {
+    if (write(fd, line.data(), line.size()) != (ssize_t)line.size() ||
+        !readReply(fd, buffer)) {
+      std::cerr << "request " << i << " failed" << std::endl;
+      return 1;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: bench_listen <socket> [clients] [requests] [command]"
+              << std::endl;
+    return 1;
+  }
+  int clients = argc > 2 ? atoi(argv[2]) : 8;
+  int requests = argc > 3 ? atoi(argv[3]) : 1000;
+  std::string command = argc > 4 ? argv[4] : "showpid";
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < clients; i++) {
+    if (fork() == 0) {
+      _exit(runClient(argv[1], requests, command));
+    }
+  }
+
+  bool failed = false;
+  int status;
+  while (wait(&status) != -1) {
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::cerr << clients << " clients x " << requests << " \"" << command
+            << "\": " << clients * requests / elapsed.count()
+            << " requests/s" << (failed ? " (some failed)" : "") << std::endl;
+  return failed;
+}
@@ -0,0 +1,136 @@
+// Measures the PATH index against searching the directories every time.
+//
+// usage: bench_path_index [directories] [files_per_directory] [queries]
+//
+// Fills temporary directories with executables and indexes them as PATH.
+// Reports how long the caller was held up while the index started, how long
+// it took to become ready, and the cost of a prefix completion and a which
+// lookup with the index and with a rescan of the directories. Then it
+// measures how long a new executable takes to show up through inotify.
+// Results go to stderr.
+#include "pathindex.h"
+#include "repeat.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static uint64_t monotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void createExecutable(const std::string &path) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0755);
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+// What completing a command costs without an index.
+static size_t scanPrefix(const std::vector<std::string> &dirs,
+                         const std::string &prefix) {
+  size_t matches = 0;
+  for (auto &&path : dirs) {
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+      continue;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+      struct stat info;
+      if (strncmp(entry->d_name, prefix.c_str(), prefix.length()) == 0 &&
+          fstatat(dirfd(dir), entry->d_name, &info, 0) == 0 &&
+          S_ISREG(info.st_mode)) {
+        matches++;
+      }
+    }
+    closedir(dir);
+  }
+  return matches;
+}
+
+int main(int argc, char *argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 12;
+  int files = argc > 2 ? atoi(argv[2]) : 500;
+  int queries = argc > 3 ? atoi(argv[3]) : 200;
+
+  char root[] = "/tmp/smash_path_index_XXXXXX";
+  if (!mkdtemp(root)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::vector<std::string> dirs;
+  std::string path;
+  for (int d = 0; d < count; d++) {
+    std::string dir = std::string(root) + "/bin" + std::to_string(d);
+    mkdir(dir.c_str(), 0755);
+    for (int f = 0; f < files; f++) {
+      createExecutable(dir + "/tool" + std::to_string(d) + "-" +
+                       std::to_string(f));
+    }
+    dirs.push_back(dir);
+    path += (path.empty() ? "" : ":") + dir;
+  }
+
+  Reactor reactor;
+  PathIndex index(reactor);
+  uint64_t start = monotonicNanos();
+  index.update(path);
+  uint64_t returned = monotonicNanos();
+  reactor.runUntil([&]() { return index.isReady(); });
+  uint64_t ready = monotonicNanos();
+  std::cerr << count << " directories, " << index.size()
+            << " executables: update returned after "
+            << (returned - start) / 1000 << " us, ready after "
+            << (ready - start) / 1000 << " us" << std::endl;
+
+  // The last directory's tools, one of the widest prefixes there is.
+  std::string prefix = "tool" + std::to_string(count - 1);
+  std::string last = prefix + "-" + std::to_string(files - 1);
+  size_t found = 0;
+  uint64_t before = monotonicNanos();
+  for (int i = 0; i < queries; i++) {
+    found += index.complete(prefix).size();
+  }
+  uint64_t indexed = (monotonicNanos() - before) / queries;
+  before = monotonicNanos();
+  for (int i = 0; i < queries; i++) {
+    found += scanPrefix(dirs, prefix);
+  }
+  uint64_t scanned = (monotonicNanos() - before) / queries;
+  std::cerr << "complete \"" << prefix << "\" (" << found / queries / 2
+            << " matches): index " << indexed / 1000 << " us, rescan "
+            << scanned / 1000 << " us" << std::endl;
+
+  before = monotonicNanos();
+  for (int i = 0; i < queries; i++) {
+    found += index.find(last).length();
+  }
+  indexed = (monotonicNanos() - before) / queries;
+  before = monotonicNanos();
+  for (int i = 0; i < queries; i++) {
+    found += resolveCommand(last, path).length();
+  }
+  scanned = (monotonicNanos() - before) / queries;
+  std::cerr << "which " << last << ": index " << indexed << " ns, search "
+            << scanned << " ns" << std::endl;
+
+  std::string added = dirs.back() + "/new-tool";
+  before = monotonicNanos();
+  createExecutable(added);
+  reactor.runUntil([&]() { return !index.find("new-tool").empty(); }, 1000);
+  std::cerr << "new executable indexed after "
+            << (monotonicNanos() - before) / 1000 << " us" << std::endl;
+
+  std::string command = std::string("rm -rf ") + root;
+  return system(command.c_str()) == 0 ? 0 : 1;
+}
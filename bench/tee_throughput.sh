@@ -0,0 +1,31 @@
+#!/bin/sh
+# Compares smash's ">|" operator with an external tee process:
+#
+#   smash: cat input >| copy | wc -c
+#   bash:  cat input | tee copy | wc -c
+#
+# usage: bench/tee_throughput.sh [path/to/smash] [size in MiB]
+SMASH=${1:-./smash}
+SIZE_MB=${2:-512}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+head -c "$((SIZE_MB * 1024 * 1024))" /dev/urandom > "$DIR/input"
+
+now() { date +%s.%N; }
+report() {
+  awk -v name="$1" -v mb="$SIZE_MB" -v start="$2" -v end="$3" \
+    'BEGIN { printf "%s: %.0f MiB/s\n", name, mb / (end - start) }'
+}
+
+start=$(now)
+printf 'cat %s >| %s | wc -c\nquit\n' "$DIR/input" "$DIR/copy1" |
+  "$SMASH" > /dev/null
+end=$(now)
+cmp -s "$DIR/input" "$DIR/copy1" || echo "smash copy differs"
+report "smash >|" "$start" "$end"
+
+start=$(now)
+bash -c "cat $DIR/input | tee $DIR/copy2 | wc -c" > /dev/null
+end=$(now)
+report "cat | tee | wc" "$start" "$end"
@@ -0,0 +1,210 @@
+#include "capture.h"
+#include "Commands.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define CAPTURE_MAX_EVENTS (64)
+
+RingBuffer::RingBuffer(size_t capacity) : capacity(capacity), head(0) {}
+
+void RingBuffer::write(const char *data, size_t length) {
+  if (length >= capacity) {
+    buffer.assign(data + length - capacity, data + length);
+    head = 0;
+    return;
+  }
+
+  // The buffer only grows as far as it is actually used.
+  size_t appended = std::min(capacity - buffer.size(), length);
+  buffer.insert(buffer.end(), data, data + appended);
+  data += appended;
+  length -= appended;
+
+  while (length > 0) {
+    size_t chunk = std::min(length, capacity - head);
+    memcpy(&buffer[head], data, chunk);
+    head = (head + chunk) % capacity;
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+std::string RingBuffer::contents() const {
+  return std::string(buffer.begin() + head, buffer.end()) +
+         std::string(buffer.begin(), buffer.begin() + head);
+}
+
+size_t RingBuffer::getCapacity() const { return capacity; }
+
+OutputCapture::OutputCapture() : enabled(false), epollFd(-1), usedSize(0) {}
+
+OutputCapture::~OutputCapture() {
+  for (auto &&entry : entries) {
+    closeEntry(entry);
+  }
+  if (epollFd != -1) {
+    close(epollFd);
+  }
+}
+
+bool OutputCapture::isEnabled() const { return enabled; }
+void OutputCapture::setEnabled(bool enabled) { this->enabled = enabled; }
+int OutputCapture::getFd() const { return epollFd; }
+size_t OutputCapture::getUsedSize() const { return usedSize; }
+
+bool OutputCapture::openPipe(int outPipe[2]) {
+  if (!enabled) {
+    return false;
+  }
+
+  auto it = entries.begin();
+  while (usedSize + CAPTURE_JOB_SIZE > CAPTURE_TOTAL_SIZE &&
+         it != entries.end()) {
+    if (it->finished) {
+      usedSize -= it->buffer.getCapacity();
+      it = entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (usedSize + CAPTURE_JOB_SIZE > CAPTURE_TOTAL_SIZE) {
+    std::cerr << "smash error: capture: memory limit reached" << std::endl;
+    return false;
+  }
+
+  if (epollFd == -1) {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+      syscallError("epoll_create1");
+      return false;
+    }
+  }
+  if (pipe2(outPipe, O_CLOEXEC) == -1) {
+    syscallError("pipe");
+    return false;
+  }
+  return true;
+}
+
+void OutputCapture::attach(int fd, pid_t pid, int jobId) {
+  entries.emplace_back(fd, pid, jobId);
+  usedSize += entries.back().buffer.getCapacity();
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = &entries.back();
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    syscallError("epoll_ctl");
+  }
+}
+
+void OutputCapture::detach(pid_t pid) {
+  for (auto &&entry : entries) {
+    if (entry.pid == pid && !entry.finished) {
+      if (entry.fd != -1) {
+        readEntry(entry, -1);
+      }
+      closeEntry(entry);
+      entry.finished = true;
+    }
+  }
+}
+
+bool OutputCapture::isCaptured(pid_t pid) const {
+  for (auto &&entry : entries) {
+    if (entry.pid == pid && !entry.finished) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool OutputCapture::hasOpenPipe(pid_t pid) const {
+  for (auto &&entry : entries) {
+    if (entry.pid == pid && entry.fd != -1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool OutputCapture::hasOpenPipes() const {
+  for (auto &&entry : entries) {
+    if (entry.fd != -1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void OutputCapture::drain(pid_t echoPid) {
+  if (epollFd == -1) {
+    return;
+  }
+
+  struct epoll_event events[CAPTURE_MAX_EVENTS];
+  int count;
+  do {
+    count = epoll_wait(epollFd, events, CAPTURE_MAX_EVENTS, 0);
+  } while (count == -1 && errno == EINTR);
+
+  for (int i = 0; i < count; i++) {
+    auto entry = (Entry *)events[i].data.ptr;
+    if (!readEntry(*entry, echoPid)) {
+      closeEntry(*entry);
+    }
+  }
+}
+
+bool OutputCapture::getOutput(int jobId, std::string &outOutput) const {
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+    if (it->jobId == jobId) {
+      outOutput = it->buffer.contents();
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads until the pipe is empty. Returns false once the pipe reached EOF.
+bool OutputCapture::readEntry(Entry &entry, pid_t echoPid) {
+  char data[CAPTURE_JOB_SIZE];
+  while (true) {
+    ssize_t length = read(entry.fd, data, sizeof(data));
+    if (length == -1 && errno == EINTR) {
+      continue;
+    }
+    if (length == -1) {
+      return errno == EAGAIN;
+    }
+    if (length == 0) {
+      return false;
+    }
+
+    entry.buffer.write(data, length);
+    if (entry.pid == echoPid) {
+      std::cout.flush();
+      for (ssize_t done = 0, written = 0; done < length; done += written) {
+        written = write(STDOUT_FILENO, data + done, length - done);
+        if (written == -1) {
+          break;
+        }
+      }
+    }
+  }
+}
+
+void OutputCapture::closeEntry(Entry &entry) {
+  if (entry.fd == -1) {
+    return;
+  }
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, entry.fd, nullptr);
+  close(entry.fd);
+  entry.fd = -1;
+}
@@ -0,0 +1,87 @@
+#ifndef SMASH_CAPTURE_H_
+#define SMASH_CAPTURE_H_
+
+#include <list>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#define CAPTURE_JOB_SIZE (64 * 1024)
+#define CAPTURE_TOTAL_SIZE (4 * 1024 * 1024)
+
+// Keeps the last `capacity` bytes written to it.
+class RingBuffer {
+public:
+  explicit RingBuffer(size_t capacity);
+  void write(const char *data, size_t length);
+  std::string contents() const;
+  size_t getCapacity() const;
+
+private:
+  const size_t capacity;
+  std::vector<char> buffer;
+  size_t head; // Oldest byte once the buffer is full.
+};
+
+// Captures the stdout/stderr of background jobs. Each captured job writes
+// into a pipe that the shell drains through one epoll set into a ring buffer
+// of CAPTURE_JOB_SIZE bytes. The buffers of all jobs, finished ones
+// included, never take more than CAPTURE_TOTAL_SIZE bytes; when a new job
+// needs room the oldest finished buffers are dropped, and if that is not
+// enough the job is not captured.
+class OutputCapture {
+public:
+  OutputCapture();
+  ~OutputCapture();
+  OutputCapture(OutputCapture const &) = delete;  // disable copy ctor
+  void operator=(OutputCapture const &) = delete; // disable = operator
+
+  bool isEnabled() const;
+  void setEnabled(bool enabled);
+
+  // Opens the pipe a new background job should write to. Returns false if
+  // capturing is off or there is no room left for another buffer.
+  bool openPipe(int outPipe[2]);
+  // Starts capturing the read end of a pipe made by openPipe.
+  void attach(int fd, pid_t pid, int jobId);
+  // Called once the job is gone, reads what is left of its output and keeps
+  // the buffer around for later dumps.
+  void detach(pid_t pid);
+
+  bool isCaptured(pid_t pid) const;
+  // Whether the job can still produce output.
+  bool hasOpenPipe(pid_t pid) const;
+  // Whether any job can still produce output.
+  bool hasOpenPipes() const;
+  // Epoll fd that becomes readable when a captured job wrote something.
+  int getFd() const;
+  // Reads whatever the jobs wrote so far without blocking. Output of echoPid
+  // is written to stdout as well.
+  void drain(pid_t echoPid = -1);
+  // The captured tail of the newest job with this id.
+  bool getOutput(int jobId, std::string &outOutput) const;
+  size_t getUsedSize() const;
+
+private:
+  struct Entry {
+    Entry(int fd, pid_t pid, int jobId)
+        : fd(fd), pid(pid), jobId(jobId), finished(false),
+          buffer(CAPTURE_JOB_SIZE) {}
+
+    int fd; // -1 once the pipe reached EOF.
+    pid_t pid;
+    int jobId;
+    bool finished;
+    RingBuffer buffer;
+  };
+
+  bool readEntry(Entry &entry, pid_t echoPid);
+  void closeEntry(Entry &entry);
+
+  bool enabled;
+  int epollFd;
+  size_t usedSize;
+  std::list<Entry> entries; // Oldest first.
+};
+
+#endif // SMASH_CAPTURE_H_
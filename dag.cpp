@@ -0,0 +1,217 @@
+#include "dag.h"
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+static std::string _trim(const std::string &text) {
+  size_t first = text.find_first_not_of(" \t\r");
+  if (first == std::string::npos) {
+    return "";
+  }
+  size_t last = text.find_last_not_of(" \t\r");
+  return text.substr(first, last - first + 1);
+}
+
+bool TaskGraph::parse(std::istream &input, std::string &outError) {
+  tasks.clear();
+  ready.clear();
+
+  std::map<std::string, size_t> names;
+  std::vector<std::vector<std::string>> dependencies;
+  std::string line;
+  for (int number = 1; std::getline(input, line); number++) {
+    std::string text = _trim(line);
+    if (text.empty() || text[0] == '#') {
+      continue;
+    }
+
+    size_t name_end = text.find(':');
+    size_t deps_end =
+        name_end == std::string::npos ? name_end : text.find(':', name_end + 1);
+    if (deps_end == std::string::npos) {
+      outError = "line " + std::to_string(number) +
+                 ": expected name: dependencies: command";
+      return false;
+    }
+
+    DagTask task;
+    task.name = _trim(text.substr(0, name_end));
+    task.command = _trim(text.substr(deps_end + 1));
+    if (task.name.empty() || task.command.empty() ||
+        task.name.find_first_of(" \t") != std::string::npos) {
+      outError = "line " + std::to_string(number) +
+                 ": expected name: dependencies: command";
+      return false;
+    }
+    if (!names.emplace(task.name, tasks.size()).second) {
+      outError = "task " + task.name + " is defined twice";
+      return false;
+    }
+
+    std::istringstream words(
+        text.substr(name_end + 1, deps_end - name_end - 1));
+    std::vector<std::string> listed;
+    for (std::string word; words >> word;) {
+      listed.push_back(word);
+    }
+    dependencies.push_back(listed);
+    tasks.push_back(task);
+  }
+
+  for (size_t i = 0; i < tasks.size(); i++) {
+    for (auto &&name : dependencies[i]) {
+      auto it = names.find(name);
+      if (it == names.end()) {
+        outError = "task " + tasks[i].name + " depends on unknown task " + name;
+        return false;
+      }
+      // A dependency listed twice still only has to finish once.
+      if (std::find(tasks[i].dependencies.begin(), tasks[i].dependencies.end(),
+                    it->second) != tasks[i].dependencies.end()) {
+        continue;
+      }
+      tasks[i].dependencies.push_back(it->second);
+      tasks[it->second].dependents.push_back(i);
+    }
+    tasks[i].unfinished = tasks[i].dependencies.size();
+  }
+
+  // Kahn's algorithm: whatever is never freed of its dependencies is on, or
+  // behind, a cycle.
+  std::vector<size_t> left(tasks.size());
+  std::vector<size_t> queue;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    left[i] = tasks[i].unfinished;
+    if (left[i] == 0) {
+      queue.push_back(i);
+    }
+  }
+  for (size_t head = 0; head < queue.size(); head++) {
+    for (size_t dependent : tasks[queue[head]].dependents) {
+      if (--left[dependent] == 0) {
+        queue.push_back(dependent);
+      }
+    }
+  }
+  if (queue.size() != tasks.size()) {
+    for (size_t i = 0; i < tasks.size(); i++) {
+      if (left[i] != 0) {
+        outError = "task " + tasks[i].name + " is part of a dependency cycle";
+        return false;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (tasks[i].unfinished == 0) {
+      tasks[i].state = DagTask::State::Ready;
+      ready.push_back(i);
+    }
+  }
+  return true;
+}
+
+size_t TaskGraph::size() const { return tasks.size(); }
+
+const DagTask &TaskGraph::getTask(size_t index) const { return tasks[index]; }
+
+bool TaskGraph::hasReady() const { return !ready.empty(); }
+
+size_t TaskGraph::popReady() {
+  size_t index = ready.front();
+  ready.pop_front();
+  return index;
+}
+
+void TaskGraph::start(size_t index, uint64_t now) {
+  tasks[index].state = DagTask::State::Running;
+  tasks[index].start_time = now;
+}
+
+std::vector<size_t> TaskGraph::finish(size_t index, bool ok, uint64_t now) {
+  DagTask &task = tasks[index];
+  task.end_time = now;
+  if (task.start_time == 0) {
+    task.start_time = now;
+  }
+
+  std::vector<size_t> skipped;
+  if (ok) {
+    task.state = DagTask::State::Done;
+    for (size_t dependent : task.dependents) {
+      if (--tasks[dependent].unfinished == 0 &&
+          tasks[dependent].state == DagTask::State::Waiting) {
+        tasks[dependent].state = DagTask::State::Ready;
+        // Keeps the order of the file among the ready tasks.
+        ready.insert(std::upper_bound(ready.begin(), ready.end(), dependent),
+                     dependent);
+      }
+    }
+    return skipped;
+  }
+
+  task.state = DagTask::State::Failed;
+  std::vector<size_t> pending(task.dependents);
+  while (!pending.empty()) {
+    size_t next = pending.back();
+    pending.pop_back();
+    // Nothing downstream of a failure was ready, so none of it is running.
+    if (tasks[next].state != DagTask::State::Waiting) {
+      continue;
+    }
+    tasks[next].state = DagTask::State::Skipped;
+    skipped.push_back(next);
+    pending.insert(pending.end(), tasks[next].dependents.begin(),
+                   tasks[next].dependents.end());
+  }
+  std::sort(skipped.begin(), skipped.end());
+  return skipped;
+}
+
+size_t TaskGraph::count(DagTask::State state) const {
+  size_t total = 0;
+  for (auto &&task : tasks) {
+    if (task.state == state) {
+      total++;
+    }
+  }
+  return total;
+}
+
+uint64_t TaskGraph::criticalPath(std::vector<size_t> &outChain) const {
+  // Dependencies always finish first, so going by end time visits each task
+  // after everything it waited for.
+  std::vector<size_t> order;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (tasks[i].state == DagTask::State::Done ||
+        tasks[i].state == DagTask::State::Failed) {
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return tasks[a].end_time < tasks[b].end_time;
+  });
+
+  std::vector<uint64_t> length(tasks.size(), 0);
+  std::vector<size_t> previous(tasks.size(), tasks.size());
+  size_t last = tasks.size();
+  for (size_t i : order) {
+    for (size_t dependency : tasks[i].dependencies) {
+      if (length[dependency] > length[i]) {
+        length[i] = length[dependency];
+        previous[i] = dependency;
+      }
+    }
+    length[i] += tasks[i].end_time - tasks[i].start_time;
+    if (last == tasks.size() || length[i] > length[last]) {
+      last = i;
+    }
+  }
+
+  outChain.clear();
+  for (size_t i = last; i != tasks.size(); i = previous[i]) {
+    outChain.push_back(i);
+  }
+  std::reverse(outChain.begin(), outChain.end());
+  return last == tasks.size() ? 0 : length[last];
+}
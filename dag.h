@@ -0,0 +1,57 @@
+#ifndef SMASH_DAG_H_
+#define SMASH_DAG_H_
+
+#include <deque>
+#include <istream>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct DagTask {
+  enum class State { Waiting, Ready, Running, Done, Failed, Skipped };
+
+  std::string name;
+  std::string command;
+  std::vector<size_t> dependencies;
+  std::vector<size_t> dependents;
+  State state = State::Waiting;
+  size_t unfinished = 0; // Dependencies that are not done yet.
+  uint64_t start_time = 0; // CLOCK_MONOTONIC nanoseconds.
+  uint64_t end_time = 0;
+};
+
+/**
+ * The tasks of a dag file and which of them can run. Each line of the file
+ * is a task, "name: dependencies: command", the dependencies separated by
+ * spaces, and may be empty. Empty lines and lines starting with # are
+ * skipped. A task is ready once all of its dependencies are done, and a
+ * task that fails skips everything downstream of it.
+ */
+class TaskGraph {
+public:
+  // Returns false with a message in outError if a line is malformed, a name
+  // is repeated or unknown, or the dependencies form a cycle.
+  bool parse(std::istream &input, std::string &outError);
+
+  size_t size() const;
+  const DagTask &getTask(size_t index) const;
+  bool hasReady() const;
+  // The next ready task, in the order of the file.
+  size_t popReady();
+  void start(size_t index, uint64_t now);
+  // Marks a started task done, or failed along with everything downstream
+  // of it. Returns the tasks that were skipped.
+  std::vector<size_t> finish(size_t index, bool ok, uint64_t now);
+  size_t count(DagTask::State state) const;
+
+  // The longest chain of tasks that ran, by how long each took, and its
+  // length in nanoseconds.
+  uint64_t criticalPath(std::vector<size_t> &outChain) const;
+
+private:
+  std::vector<DagTask> tasks;
+  std::deque<size_t> ready;
+};
+
+#endif // SMASH_DAG_H_
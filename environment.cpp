@@ -0,0 +1,135 @@
+#include "environment.h"
+#include <algorithm>
+#include <ctype.h>
+#include <string.h>
+
+extern char **environ;
+
+Environment::Environment() : builds(0) {
+  for (char **entry = environ; *entry; entry++) {
+    const char *equals = strchr(*entry, '=');
+    if (equals) {
+      variables[std::string(*entry, equals - *entry)] = {equals + 1, true};
+    }
+  }
+}
+
+const std::string *Environment::get(const std::string &name) const {
+  auto it = variables.find(name);
+  return it == variables.end() ? nullptr : &it->second.value;
+}
+
+void Environment::set(const std::string &name, const std::string &value) {
+  auto it = variables.find(name);
+  if (it == variables.end()) {
+    variables[name] = {value, false};
+    return;
+  }
+  if (it->second.exported && it->second.value != value) {
+    block.reset();
+  }
+  it->second.value = value;
+}
+
+void Environment::exportName(const std::string &name) {
+  // Like bash, exporting a variable that is not set does not set it.
+  auto it = variables.find(name);
+  if (it != variables.end() && !it->second.exported) {
+    it->second.exported = true;
+    block.reset();
+  }
+}
+
+void Environment::unset(const std::string &name) {
+  auto it = variables.find(name);
+  if (it == variables.end()) {
+    return;
+  }
+  if (it->second.exported) {
+    block.reset();
+  }
+  variables.erase(it);
+}
+
+std::vector<std::string> Environment::getExported() const {
+  std::vector<std::string> exported;
+  for (auto &&variable : variables) {
+    if (variable.second.exported) {
+      exported.push_back(variable.first + "=" + variable.second.value);
+    }
+  }
+  std::sort(exported.begin(), exported.end());
+  return exported;
+}
+
+std::shared_ptr<const EnvBlock> Environment::getBlock() {
+  if (block) {
+    return block;
+  }
+
+  auto rebuilt = std::make_shared<EnvBlock>();
+  rebuilt->entries = getExported();
+  for (auto &&entry : rebuilt->entries) {
+    rebuilt->envp.push_back((char *)entry.c_str());
+  }
+  rebuilt->envp.push_back(nullptr);
+  block = rebuilt;
+  builds++;
+  return block;
+}
+
+uint64_t Environment::getBuilds() const { return builds; }
+
+bool isValidName(const std::string &name) {
+  if (name.empty() || isdigit((unsigned char)name[0])) {
+    return false;
+  }
+  return std::all_of(name.begin(), name.end(), [](char c) {
+    return isalnum((unsigned char)c) || c == '_';
+  });
+}
+
+bool isAssignment(const std::string &word) {
+  size_t equals = word.find('=');
+  return equals != std::string::npos && isValidName(word.substr(0, equals));
+}
+
+// Whether two NAME=value entries set the same variable.
+static bool _sameName(const char *a, const char *b) {
+  for (; *a == *b && *a != '\0'; a++, b++) {
+    if (*a == '=') {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<char *>
+layerEnvironment(const EnvBlock &block,
+                 const std::vector<std::string> &overrides) {
+  std::vector<char *> envp;
+  envp.reserve(block.envp.size() + overrides.size());
+  for (char *entry : block.envp) {
+    if (!entry) {
+      break;
+    }
+    bool overridden =
+        std::any_of(overrides.begin(), overrides.end(),
+                    [&](const std::string &other) {
+                      return _sameName(entry, other.c_str());
+                    });
+    if (!overridden) {
+      envp.push_back(entry);
+    }
+  }
+  // Of overrides of the same variable, the last one counts.
+  for (auto it = overrides.begin(); it != overrides.end(); it++) {
+    if (std::none_of(it + 1, overrides.end(), [&](const std::string &other) {
+          return _sameName(it->c_str(), other.c_str());
+        })) {
+      envp.push_back((char *)it->c_str());
+    }
+  }
+  envp.push_back(nullptr);
+  return envp;
+}
@@ -0,0 +1,67 @@
+#ifndef SMASH_ENVIRONMENT_H_
+#define SMASH_ENVIRONMENT_H_
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The environment commands are started with, as execve takes it.
+struct EnvBlock {
+  EnvBlock() = default;
+  EnvBlock(EnvBlock const &) = delete;      // envp points into entries
+  void operator=(EnvBlock const &) = delete; // disable = operator
+
+  std::vector<std::string> entries; // NAME=value
+  std::vector<char *> envp;         // Into entries, null terminated.
+};
+
+// The shell's variables. Those inherited from smash's own environment start
+// out exported, others are exported with export. The exported ones make up
+// an EnvBlock that is only rebuilt when one of them changed, every command
+// launched in between shares the same one. A block being used by a launch
+// stays valid, a change makes a new one.
+class Environment {
+public:
+  Environment();
+  Environment(Environment const &) = delete;  // disable copy ctor
+  void operator=(Environment const &) = delete; // disable = operator
+
+  // The variable's value, nullptr if it is not set.
+  const std::string *get(const std::string &name) const;
+  void set(const std::string &name, const std::string &value);
+  void exportName(const std::string &name);
+  void unset(const std::string &name);
+  // NAME=value of every exported variable, sorted by name.
+  std::vector<std::string> getExported() const;
+
+  std::shared_ptr<const EnvBlock> getBlock();
+  // How many times the block was built.
+  uint64_t getBuilds() const;
+
+private:
+  struct Variable {
+    std::string value;
+    bool exported;
+  };
+
+  std::unordered_map<std::string, Variable> variables;
+  std::shared_ptr<const EnvBlock> block; // nullptr once it is out of date.
+  uint64_t builds;
+};
+
+// Whether name can be a variable's name: a letter or underscore, followed
+// by letters, digits and underscores.
+bool isValidName(const std::string &name);
+// Whether word is a NAME=value assignment.
+bool isAssignment(const std::string &word);
+/**
+ * The block's envp with the NAME=value overrides in place of the variables
+ * they name, for VAR=value prefixes. The block itself is left as it is,
+ * only its pointers are copied.
+ */
+std::vector<char *> layerEnvironment(const EnvBlock &block,
+                                     const std::vector<std::string> &overrides);
+
+#endif // SMASH_ENVIRONMENT_H_
@@ -0,0 +1,384 @@
+#include "forkserver.h"
+#include "Commands.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Received fds are moved at least this high before the plan is applied, so
+// the plan's own targets can not overwrite them.
+#define FORK_SERVER_FD_BASE (64)
+
+struct LaunchReply {
+  int32_t pid;
+  int32_t error;
+};
+
+static void _putInt(std::string &message, int32_t value) {
+  message.append((const char *)&value, sizeof(value));
+}
+
+static void _putString(std::string &message, const std::string &text) {
+  message += text;
+  message += '\0';
+}
+
+// Reads back what _putInt and _putString wrote, failing on truncated input.
+struct MessageReader {
+  const char *data;
+  size_t length;
+  size_t position;
+  bool failed;
+
+  int32_t getInt() {
+    int32_t value = 0;
+    if (position + sizeof(value) > length) {
+      failed = true;
+      return 0;
+    }
+    memcpy(&value, data + position, sizeof(value));
+    position += sizeof(value);
+    return value;
+  }
+
+  std::string getString() {
+    const void *end = position < length
+                          ? memchr(data + position, '\0', length - position)
+                          : nullptr;
+    if (!end) {
+      failed = true;
+      return "";
+    }
+    std::string text(data + position, (const char *)end);
+    position += text.length() + 1;
+    return text;
+  }
+};
+
+/**
+ * Runs in the clone the helper made for a request: sets the command up the
+ * way a forked child of the shell would be and execs it. Dup sources below
+ * zero refer to the received fds.
+ */
+static void _runCommand(MessageReader &reader, const std::vector<int> &fds) {
+  // Lets the helper send the pid first. Otherwise, with few cores, the
+  // shell waits for the reply while the command execs.
+  sched_yield();
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, nullptr);
+
+  std::vector<int> moved;
+  for (int fd : fds) {
+    moved.push_back(fcntl(fd, F_DUPFD_CLOEXEC, FORK_SERVER_FD_BASE));
+  }
+  for (int fd = 0; fd < 3; fd++) {
+    dup2(moved[fd], fd);
+  }
+  // First change group ID to prevent shell signals from being received.
+  if (setpgrp() != 0) {
+    syscallError("setpgrp");
+  }
+
+  std::vector<std::string> args(std::max(reader.getInt(), 0));
+  for (auto &&arg : args) {
+    arg = reader.getString();
+  }
+  std::string cwd = reader.getString();
+  if (chdir(cwd.c_str()) == -1) {
+    syscallError("chdir");
+    _exit(1);
+  }
+  for (int count = reader.getInt(); count > 0; count--) {
+    std::string entry = reader.getString();
+    size_t equals = entry.find('=');
+    if (equals == std::string::npos) {
+      unsetenv(entry.c_str());
+    } else {
+      setenv(entry.substr(0, equals).c_str(), entry.c_str() + equals + 1, 1);
+    }
+  }
+
+  RedirectionPlan plan;
+  for (int count = reader.getInt(); count > 0; count--) {
+    FdAction action;
+    action.type = (FdAction::Type)reader.getInt();
+    action.fd = reader.getInt();
+    action.flags = reader.getInt();
+    action.source = reader.getInt();
+    action.path = reader.getString();
+    if (action.source < 0 && -action.source - 1 < (int)moved.size()) {
+      action.source = moved[-action.source - 1];
+    }
+    plan.push_back(action);
+  }
+  if (reader.failed || args.empty() || !applyRedirections(plan)) {
+    _exit(1);
+  }
+
+  std::vector<char *> argv;
+  for (auto &&arg : args) {
+    argv.push_back((char *)arg.c_str());
+  }
+  argv.push_back(nullptr);
+  execvp(argv[0], argv.data());
+  syscallError("execvp");
+  _exit(1);
+}
+
+/**
+ * The helper's loop: one request in, one clone and one reply out, until
+ * the shell closes its end.
+ */
+static void _serve(int sock) {
+  static char message[FORK_SERVER_MAX_MESSAGE];
+  char control[CMSG_SPACE(sizeof(int) * FORK_SERVER_MAX_FDS)];
+
+  while (true) {
+    struct iovec iov = {message, sizeof(message)};
+    struct msghdr header = {};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    ssize_t length = recvmsg(sock, &header, MSG_CMSG_CLOEXEC);
+    if (length == -1 && errno == EINTR) {
+      continue;
+    }
+    if (length <= 0) {
+      _exit(0);
+    }
+
+    std::vector<int> fds;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg;
+         cmsg = CMSG_NXTHDR(&header, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *received = (int *)CMSG_DATA(cmsg);
+        fds.insert(fds.end(), received, received + count);
+      }
+    }
+
+    LaunchReply reply = {-1, 0};
+    if (fds.size() < 3) {
+      reply.error = EINVAL;
+    } else {
+      // Like fork, but the command's parent is the shell, not the helper.
+      reply.pid = (pid_t)syscall(SYS_clone, CLONE_PARENT | SIGCHLD, nullptr,
+                                 nullptr, nullptr, nullptr);
+      if (reply.pid == 0) {
+        MessageReader reader = {message, (size_t)length, 0, false};
+        _runCommand(reader, fds);
+      }
+      reply.error = reply.pid == -1 ? errno : 0;
+    }
+    for (int fd : fds) {
+      close(fd);
+    }
+    while (send(sock, &reply, sizeof(reply), 0) == -1 && errno == EINTR) {
+    }
+  }
+}
+
+ForkServer::ForkServer() : sock(-1), helper(-1), owner(getpid()) {}
+
+ForkServer::~ForkServer() { stop(); }
+
+bool ForkServer::start() {
+  int socks[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) == -1) {
+    return false;
+  }
+
+  helper = fork();
+  if (helper == -1) {
+    close(socks[0]);
+    close(socks[1]);
+    return false;
+  }
+  if (helper == 0) {
+    close(socks[0]);
+    // Commands get the shell's stdio with every request, the helper holding
+    // on to it would keep pipes open.
+    int null = open("/dev/null", O_RDWR);
+    for (int fd = 0; fd < 3 && null != -1; fd++) {
+      dup2(null, fd);
+    }
+    // The helper shares the shell's process group, the terminal's ctrl-C
+    // and ctrl-Z are not meant for it.
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGALRM, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    _serve(socks[1]);
+  }
+
+  close(socks[1]);
+  sock = socks[0];
+  owner = getpid();
+  for (char **entry = environ; *entry; entry++) {
+    environment.insert(*entry);
+  }
+  return true;
+}
+
+void ForkServer::stop() {
+  if (sock == -1 || getpid() != owner) {
+    return;
+  }
+  // The helper exits once its end of the socket reads EOF.
+  close(sock);
+  sock = -1;
+  while (waitpid(helper, nullptr, 0) == -1 && errno == EINTR) {
+  }
+  helper = -1;
+}
+
+bool ForkServer::isRunning() const { return sock != -1; }
+
+pid_t ForkServer::launch(const std::vector<std::string> &args,
+                         const std::shared_ptr<const EnvBlock> &block,
+                         const std::vector<std::string> &overrides,
+                         const RedirectionPlan &plan) {
+  if (sock == -1) {
+    errno = ENOTCONN;
+    return -1;
+  }
+
+  std::string message;
+  _putInt(message, args.size());
+  for (auto &&arg : args) {
+    _putString(message, arg);
+  }
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    return -1;
+  }
+  _putString(message, cwd);
+
+  if (block != delta_block) {
+    delta.clear();
+    std::unordered_set<std::string> names;
+    for (auto &&entry : block->entries) {
+      names.insert(entry.substr(0, entry.find('=')));
+      if (!environment.count(entry)) {
+        delta.push_back(entry);
+      }
+    }
+    for (auto &&entry : environment) {
+      std::string name = entry.substr(0, entry.find('='));
+      if (!names.count(name)) {
+        delta.push_back(name);
+      }
+    }
+    delta_block = block;
+  }
+  // Applied in order, the overrides come last.
+  _putInt(message, delta.size() + overrides.size());
+  for (auto &&entry : delta) {
+    _putString(message, entry);
+  }
+  for (auto &&entry : overrides) {
+    _putString(message, entry);
+  }
+
+  // The command starts with the shell's stdio. A dup from an fd the plan
+  // did not set itself is a shell fd, which is passed along. So are the
+  // memfds of here-documents, which the message could not hold.
+  std::vector<int> fds = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  std::unordered_set<int> defined = {STDIN_FILENO, STDOUT_FILENO,
+                                     STDERR_FILENO};
+  std::vector<int> documents;
+  auto closeDocuments = [&]() {
+    for (int fd : documents) {
+      close(fd);
+    }
+  };
+  _putInt(message, plan.size());
+  for (auto &&action : plan) {
+    FdAction::Type type = action.type;
+    int source = action.source;
+    if (type == FdAction::Type::Data) {
+      source = openHereDocument(action.path);
+      if (source == -1) {
+        closeDocuments();
+        return -1;
+      }
+      documents.push_back(source);
+      type = FdAction::Type::Dup;
+    }
+    if (type == FdAction::Type::Dup && !defined.count(source)) {
+      fds.push_back(source);
+      source = -(int)fds.size();
+    }
+    defined.insert(action.fd);
+    _putInt(message, (int32_t)type);
+    _putInt(message, action.fd);
+    _putInt(message, action.flags);
+    _putInt(message, source);
+    _putString(message, type == FdAction::Type::Dup ? "" : action.path);
+  }
+  if (fds.size() > FORK_SERVER_MAX_FDS ||
+      message.size() > FORK_SERVER_MAX_MESSAGE) {
+    closeDocuments();
+    errno = E2BIG;
+    return -1;
+  }
+
+  char control[CMSG_SPACE(sizeof(int) * FORK_SERVER_MAX_FDS)] = {};
+  struct iovec iov = {(void *)message.data(), message.size()};
+  struct msghdr header = {};
+  header.msg_iov = &iov;
+  header.msg_iovlen = 1;
+  header.msg_control = control;
+  header.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+  ssize_t res;
+  while ((res = sendmsg(sock, &header, MSG_NOSIGNAL)) == -1 &&
+         errno == EINTR) {
+  }
+  // The server got copies of them, if anything.
+  closeDocuments();
+  if (res == -1) {
+    if (errno == EPIPE || errno == ECONNRESET) {
+      stop();
+    }
+    return -1;
+  }
+
+  LaunchReply reply;
+  while ((res = recv(sock, &reply, sizeof(reply), 0)) == -1 &&
+         errno == EINTR) {
+  }
+  if (res != sizeof(reply)) {
+    stop();
+    errno = ECONNRESET;
+    return -1;
+  }
+  if (reply.pid == -1) {
+    errno = reply.error;
+    return -1;
+  }
+  return reply.pid;
+}
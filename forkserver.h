@@ -0,0 +1,52 @@
+#ifndef SMASH_FORKSERVER_H_
+#define SMASH_FORKSERVER_H_
+
+#include "environment.h"
+#include "redirection.h"
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <unordered_set>
+#include <vector>
+
+#define FORK_SERVER_MAX_FDS (16)
+#define FORK_SERVER_MAX_MESSAGE (64 * 1024)
+
+// Starts external commands from a small helper process, so the cost of a
+// launch does not grow with the shell's memory. The helper is forked when
+// the shell starts, while the shell is still small, and waits for requests
+// on a unix socket: the arguments, the working directory, what changed in
+// the environment and the redirection plan, with the shell's stdio and the
+// fds the plan reads passed along as SCM_RIGHTS. It clones every command
+// with CLONE_PARENT, so the command is the shell's child like a forked one
+// would be, and waitpid, SIGCHLD and job control work the same.
+class ForkServer {
+public:
+  ForkServer();
+  ~ForkServer();
+  ForkServer(ForkServer const &) = delete;     // disable copy ctor
+  void operator=(ForkServer const &) = delete; // disable = operator
+
+  bool start();
+  void stop();
+  bool isRunning() const;
+  // Starts args in the block's environment, with the overrides on top and
+  // the plan applied. Returns its pid, or -1 with errno set. The helper is
+  // stopped if it stopped answering.
+  pid_t launch(const std::vector<std::string> &args,
+               const std::shared_ptr<const EnvBlock> &block,
+               const std::vector<std::string> &overrides,
+               const RedirectionPlan &plan);
+
+private:
+  int sock;
+  pid_t helper;
+  pid_t owner;
+  // The environment the helper was started with, the delta is sent.
+  std::unordered_set<std::string> environment;
+  // The delta for the last block, which only changes with the block.
+  std::shared_ptr<const EnvBlock> delta_block;
+  std::vector<std::string> delta;
+};
+
+#endif // SMASH_FORKSERVER_H_
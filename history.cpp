@@ -0,0 +1,286 @@
+#include "history.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint32_t _trigram(const char *text) {
+  return (uint32_t)(unsigned char)text[0] << 16 |
+         (uint32_t)(unsigned char)text[1] << 8 | (unsigned char)text[2];
+}
+
+static bool _contains(const char *data, size_t length,
+                      const std::string &pattern) {
+  return memmem(data, length, pattern.data(), pattern.length()) != nullptr;
+}
+
+size_t History::TextHash::operator()(const Text &text) const {
+  // FNV-1a
+  size_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < text.length; i++) {
+    hash = (hash ^ (unsigned char)text.data[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool History::TextLess::operator()(const Text &a, const Text &b) const {
+  int res = memcmp(a.data, b.data, std::min(a.length, b.length));
+  return res < 0 || (res == 0 && a.length < b.length);
+}
+
+bool History::TextEqual::operator()(const Text &a, const Text &b) const {
+  return a.length == b.length && memcmp(a.data, b.data, a.length) == 0;
+}
+
+History::History()
+    : fd(-1), owner(getpid()), mapped(nullptr), mapped_size(0),
+      indexed(false) {}
+
+History::~History() {
+  flush();
+  if (mapped) {
+    munmap((void *)mapped, mapped_size);
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+/**
+ * Opens the history file at path, creating it if needed, and maps what it
+ * holds. Without a file the history only lives in memory.
+ */
+bool History::open(const std::string &path) {
+  fd = ::open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) == -1) {
+    return false;
+  }
+  if (info.st_size == 0) {
+    return true;
+  }
+
+  void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  mapped = (const char *)data;
+  mapped_size = info.st_size;
+  // A partial last line was left by a shell that died while writing.
+  while (mapped_size > 0 && mapped[mapped_size - 1] != '\n') {
+    mapped_size--;
+  }
+  return true;
+}
+
+void History::add(const std::string &line) {
+  added.push_back(line);
+  if (indexed) {
+    indexEntry(offsets.size() + added.size() - 1);
+  }
+
+  pending += line;
+  pending += '\n';
+  if (pending.size() >= HISTORY_BATCH_SIZE) {
+    flush();
+  }
+}
+
+/**
+ * Appends the pending commands to the file. O_APPEND keeps the batches of
+ * shells sharing the file whole. Forked children never write.
+ */
+void History::flush() {
+  if (fd == -1 || pending.empty() || getpid() != owner) {
+    return;
+  }
+
+  size_t written = 0;
+  while (written < pending.size()) {
+    ssize_t res = write(fd, pending.data() + written, pending.size() - written);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1) {
+      break;
+    }
+    written += res;
+  }
+  pending.clear();
+}
+
+size_t History::getSize() {
+  if (!indexed) {
+    // Counting the mapped entries means reading them, the index does that.
+    buildIndex();
+  }
+  return offsets.size() + added.size();
+}
+
+std::string History::getEntry(size_t number) const {
+  Text text = entryText(number);
+  return std::string(text.data, text.length);
+}
+
+History::Text History::entryText(size_t number) const {
+  if (number >= offsets.size()) {
+    const std::string &line = added[number - offsets.size()];
+    return {line.data(), line.length()};
+  }
+
+  size_t start = offsets[number];
+  size_t end = number + 1 < offsets.size() ? offsets[number + 1] : mapped_size;
+  // Without the newline.
+  return {mapped + start, end - start - 1};
+}
+
+void History::buildIndex() {
+  const char *position = mapped;
+  const char *end = mapped + mapped_size;
+  while (position < end) {
+    offsets.push_back(position - mapped);
+    position = (const char *)memchr(position, '\n', end - position) + 1;
+  }
+
+  // Sorted once at the end rather than one insert at a time.
+  indexed = false;
+  for (size_t i = 0; i < offsets.size() + added.size(); i++) {
+    indexEntry(i);
+  }
+  indexed = true;
+  std::sort(sorted_commands.begin(), sorted_commands.end(),
+            [this](uint32_t a, uint32_t b) {
+              return TextLess()(commands[a], commands[b]);
+            });
+}
+
+void History::indexEntry(size_t number) {
+  Text text = entryText(number);
+  auto it = command_ids.find(text);
+  if (it != command_ids.end()) {
+    command_entries[it->second].push_back(number);
+    return;
+  }
+
+  uint32_t id = commands.size();
+  commands.push_back(text);
+  command_entries.push_back(std::vector<uint32_t>(1, number));
+  command_ids.emplace(text, id);
+
+  if (indexed) {
+    auto position = std::lower_bound(
+        sorted_commands.begin(), sorted_commands.end(), text,
+        [this](uint32_t command, const Text &text) {
+          return TextLess()(commands[command], text);
+        });
+    sorted_commands.insert(position, id);
+  } else {
+    sorted_commands.push_back(id);
+  }
+
+  for (size_t i = 0; i + 3 <= text.length; i++) {
+    auto &ids = trigrams[_trigram(text.data + i)];
+    // A command repeating a trigram is listed once.
+    if (ids.empty() || ids.back() != id) {
+      ids.push_back(id);
+    }
+  }
+}
+
+/**
+ * The distinct commands starting with prefix and containing pattern.
+ */
+std::vector<uint32_t>
+History::findCommands(const std::string &prefix,
+                      const std::string &pattern) const {
+  // Candidates from the prefix range of the sorted commands, or from the
+  // rarest trigram of the pattern, narrowed down by the other condition.
+  std::vector<uint32_t> candidates;
+  if (!prefix.empty()) {
+    auto begin = std::lower_bound(
+        sorted_commands.begin(), sorted_commands.end(), prefix,
+        [this](uint32_t command, const std::string &prefix) {
+          const Text &text = commands[command];
+          int res = memcmp(text.data, prefix.data(),
+                           std::min(text.length, prefix.length()));
+          return res < 0 || (res == 0 && text.length < prefix.length());
+        });
+    for (auto it = begin; it != sorted_commands.end(); ++it) {
+      const Text &text = commands[*it];
+      if (text.length < prefix.length() ||
+          memcmp(text.data, prefix.data(), prefix.length()) != 0) {
+        break;
+      }
+      candidates.push_back(*it);
+    }
+  } else if (pattern.length() >= 3) {
+    const std::vector<uint32_t> *rarest = nullptr;
+    for (size_t i = 0; i + 3 <= pattern.length(); i++) {
+      auto it = trigrams.find(_trigram(pattern.data() + i));
+      if (it == trigrams.end()) {
+        return candidates;
+      }
+      if (!rarest || it->second.size() < rarest->size()) {
+        rarest = &it->second;
+      }
+    }
+    candidates = *rarest;
+  } else {
+    for (uint32_t id = 0; id < commands.size(); id++) {
+      candidates.push_back(id);
+    }
+  }
+
+  if (pattern.empty()) {
+    return candidates;
+  }
+  std::vector<uint32_t> found;
+  for (auto id : candidates) {
+    if (_contains(commands[id].data, commands[id].length, pattern)) {
+      found.push_back(id);
+    }
+  }
+  return found;
+}
+
+/**
+ * Entry numbers of the newest `limit` entries (all of them for 0) that start
+ * with prefix and contain pattern, oldest first.
+ */
+std::vector<size_t> History::search(const std::string &prefix,
+                                    const std::string &pattern,
+                                    size_t limit) {
+  if (!indexed) {
+    buildIndex();
+  }
+
+  size_t size = offsets.size() + added.size();
+  std::vector<size_t> entries;
+  if (prefix.empty() && pattern.empty()) {
+    size_t first = limit == 0 || limit > size ? 0 : size - limit;
+    for (size_t i = first; i < size; i++) {
+      entries.push_back(i);
+    }
+    return entries;
+  }
+
+  for (auto id : findCommands(prefix, pattern)) {
+    auto &numbers = command_entries[id];
+    // Each command only contributes its own newest entries.
+    size_t first =
+        limit == 0 || limit > numbers.size() ? 0 : numbers.size() - limit;
+    entries.insert(entries.end(), numbers.begin() + first, numbers.end());
+  }
+  std::sort(entries.begin(), entries.end());
+  if (limit != 0 && entries.size() > limit) {
+    entries.erase(entries.begin(), entries.end() - limit);
+  }
+  return entries;
+}
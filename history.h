@@ -0,0 +1,75 @@
+#ifndef SMASH_HISTORY_H_
+#define SMASH_HISTORY_H_
+
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#define HISTORY_FILE_NAME ".smash_history"
+#define HISTORY_BATCH_SIZE (4096)
+
+// Command history kept in an append-only file, one command per line.
+// Opening only maps the file, nothing is read until the first search, which
+// builds the index: the offset of every entry, and for every distinct
+// command its entries, its place in a sorted array for prefix searches and
+// its trigrams for substring searches. New commands are written before
+// each prompt, on quit, or once HISTORY_BATCH_SIZE bytes are pending, and
+// never fsync'ed.
+class History {
+public:
+  History();
+  ~History();
+  History(History const &) = delete;       // disable copy ctor
+  void operator=(History const &) = delete; // disable = operator
+
+  bool open(const std::string &path);
+  void add(const std::string &line);
+  void flush();
+  size_t getSize();
+  std::string getEntry(size_t number) const;
+  std::vector<size_t> search(const std::string &prefix,
+                             const std::string &pattern, size_t limit);
+
+private:
+  struct Text {
+    const char *data;
+    size_t length;
+  };
+  struct TextHash {
+    size_t operator()(const Text &text) const;
+  };
+  struct TextLess {
+    bool operator()(const Text &a, const Text &b) const;
+  };
+  struct TextEqual {
+    bool operator()(const Text &a, const Text &b) const;
+  };
+
+  Text entryText(size_t number) const;
+  void buildIndex();
+  void indexEntry(size_t number);
+  std::vector<uint32_t> findCommands(const std::string &prefix,
+                                     const std::string &pattern) const;
+
+  int fd;
+  pid_t owner;
+  const char *mapped;
+  size_t mapped_size;
+  // Commands added since the file was mapped. A deque never moves them, so
+  // the index can point into them.
+  std::deque<std::string> added;
+  std::string pending;
+
+  bool indexed;
+  std::vector<size_t> offsets; // Of every mapped entry.
+  std::vector<Text> commands; // Distinct commands, in order of appearance.
+  std::vector<std::vector<uint32_t>> command_entries;
+  std::unordered_map<Text, uint32_t, TextHash, TextEqual> command_ids;
+  std::vector<uint32_t> sorted_commands;
+  std::unordered_map<uint32_t, std::vector<uint32_t>> trigrams;
+};
+
+#endif // SMASH_HISTORY_H_
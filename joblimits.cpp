@@ -0,0 +1,228 @@
+#include "joblimits.h"
+#include "Commands.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char SIZE_UNITS[] = "KMGT";
+
+static int _parseNumber(const std::string &text) {
+  int value = std::stoi(text);
+  if (std::to_string(value).length() != text.length()) {
+    throw std::exception();
+  }
+  return value;
+}
+
+/**
+ * Parses a non-negative limit or "unlimited". With units, a K, M, G or T
+ * suffix multiplies it by the matching power of 1024.
+ */
+static rlim_t _parseLimit(std::string text, bool units) {
+  if (text == "unlimited") {
+    return RLIM_INFINITY;
+  }
+
+  rlim_t scale = 1;
+  if (units && !text.empty() && isalpha((unsigned char)text.back())) {
+    const char *unit = strchr(SIZE_UNITS, toupper(text.back()));
+    if (!unit) {
+      throw std::exception();
+    }
+    scale = (rlim_t)1 << (10 * (unit - SIZE_UNITS + 1));
+    text.pop_back();
+  }
+
+  int value = _parseNumber(text);
+  if (value < 0) {
+    throw std::exception();
+  }
+  return (rlim_t)value * scale;
+}
+
+static std::string _formatLimit(rlim_t value, bool units) {
+  if (value == RLIM_INFINITY) {
+    return "unlimited";
+  }
+  int unit = 0;
+  while (units && value != 0 && value % 1024 == 0 &&
+         SIZE_UNITS[unit] != '\0') {
+    value /= 1024;
+    unit++;
+  }
+  std::string text = std::to_string(value);
+  if (unit > 0) {
+    text += SIZE_UNITS[unit - 1];
+  }
+  return text;
+}
+
+/**
+ * Parses "idle", or "rt" or "be" with an optional ":level" from 0 to 7.
+ */
+static int _parseIoprio(const std::string &text) {
+  if (text == "idle") {
+    return IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+  }
+
+  std::string name = text.substr(0, text.find(':'));
+  int level = 4;
+  if (name.length() != text.length()) {
+    level = _parseNumber(text.substr(name.length() + 1));
+  }
+  if (level < 0 || level > 7) {
+    throw std::exception();
+  }
+  if (name == "rt") {
+    return IOPRIO_CLASS_RT << IOPRIO_CLASS_SHIFT | level;
+  } else if (name == "be") {
+    return IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | level;
+  }
+  throw std::exception();
+}
+
+bool parseLimitOption(char **argv, int argc, int &index,
+                      ResourceLimits &limits) {
+  std::string option = argv[index];
+  if (option != "--nice" && option != "--ioprio" && option != "--as" &&
+      option != "--cpu" && option != "--nofile") {
+    return false;
+  }
+  if (index + 1 >= argc) {
+    throw std::exception();
+  }
+  std::string value = argv[index + 1];
+  index += 2;
+
+  if (option == "--nice") {
+    limits.nice = _parseNumber(value);
+    if (limits.nice < -20 || limits.nice > 19) {
+      throw std::exception();
+    }
+    limits.has_nice = true;
+  } else if (option == "--ioprio") {
+    limits.ioprio = _parseIoprio(value);
+    limits.has_ioprio = true;
+  } else if (option == "--as") {
+    limits.rlimits.emplace_back(RLIMIT_AS, _parseLimit(value, true));
+  } else if (option == "--cpu") {
+    limits.rlimits.emplace_back(RLIMIT_CPU, _parseLimit(value, false));
+  } else {
+    limits.rlimits.emplace_back(RLIMIT_NOFILE, _parseLimit(value, false));
+  }
+  return true;
+}
+
+bool applyOwnLimits(const ResourceLimits &limits) {
+  if (limits.has_nice && setpriority(PRIO_PROCESS, 0, limits.nice) == -1) {
+    syscallError("setpriority");
+    return false;
+  }
+  if (limits.has_ioprio &&
+      syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, limits.ioprio) == -1) {
+    syscallError("ioprio_set");
+    return false;
+  }
+  for (auto &&limit : limits.rlimits) {
+    // Like ulimit, the hard limit goes too, the job can not raise it back.
+    struct rlimit value = {limit.second, limit.second};
+    if (setrlimit(limit.first, &value) == -1) {
+      syscallError("setrlimit");
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * The nice value and the I/O priority are set for the whole group by the
+ * kernel. Resource limits only exist per process, so they are set on every
+ * process currently in the group.
+ */
+bool applyGroupLimits(pid_t pgid, const ResourceLimits &limits) {
+  if (limits.has_nice && setpriority(PRIO_PGRP, pgid, limits.nice) == -1) {
+    syscallError("setpriority");
+    return false;
+  }
+  if (limits.has_ioprio &&
+      syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, pgid, limits.ioprio) == -1) {
+    syscallError("ioprio_set");
+    return false;
+  }
+  if (limits.rlimits.empty()) {
+    return true;
+  }
+
+  DIR *proc = opendir("/proc");
+  if (!proc) {
+    syscallError("opendir");
+    return false;
+  }
+  bool ok = true;
+  for (struct dirent *entry; ok && (entry = readdir(proc));) {
+    pid_t pid = atoi(entry->d_name);
+    if (pid <= 0 || getpgid(pid) != pgid) {
+      continue;
+    }
+    for (auto &&limit : limits.rlimits) {
+      struct rlimit value = {limit.second, limit.second};
+      auto resource = (__rlimit_resource)limit.first;
+      // A process that exited since it was listed has nothing to limit.
+      if (prlimit(pid, resource, &value, nullptr) == -1 && errno != ESRCH) {
+        syscallError("prlimit");
+        ok = false;
+        break;
+      }
+    }
+  }
+  closedir(proc);
+  return ok;
+}
+
+std::string describeLimits(pid_t pid) {
+  errno = 0;
+  int nice = getpriority(PRIO_PROCESS, pid);
+  if (nice == -1 && errno != 0) {
+    return "";
+  }
+  std::string text = "nice=" + std::to_string(nice);
+
+  long ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+  if (ioprio != -1) {
+    int ioClass = ioprio >> IOPRIO_CLASS_SHIFT;
+    int level = ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1);
+    if (ioClass == IOPRIO_CLASS_IDLE) {
+      text += " ioprio=idle";
+    } else if (ioClass == IOPRIO_CLASS_RT) {
+      text += " ioprio=rt:" + std::to_string(level);
+    } else {
+      // Without a class of its own a process is best effort, at a level
+      // that follows its nice value.
+      if (ioClass == IOPRIO_CLASS_NONE) {
+        level = (nice + 20) / 5;
+      }
+      text += " ioprio=be:" + std::to_string(level);
+    }
+  }
+
+  const struct {
+    const char *name;
+    int resource;
+    bool units;
+  } shown[] = {{"as", RLIMIT_AS, true},
+               {"cpu", RLIMIT_CPU, false},
+               {"nofile", RLIMIT_NOFILE, false}};
+  for (auto &&limit : shown) {
+    struct rlimit value;
+    auto resource = (__rlimit_resource)limit.resource;
+    if (prlimit(pid, resource, nullptr, &value) == 0) {
+      text += std::string(" ") + limit.name + "=" +
+              _formatLimit(value.rlim_cur, limit.units);
+    }
+  }
+  return text;
+}
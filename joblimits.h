@@ -0,0 +1,41 @@
+#ifndef SMASH_JOBLIMITS_H_
+#define SMASH_JOBLIMITS_H_
+
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <vector>
+
+#define IOPRIO_CLASS_SHIFT (13)
+#define IOPRIO_CLASS_NONE (0)
+#define IOPRIO_CLASS_RT (1)
+#define IOPRIO_CLASS_BE (2)
+#define IOPRIO_CLASS_IDLE (3)
+#define IOPRIO_WHO_PROCESS (1)
+#define IOPRIO_WHO_PGRP (2)
+
+// Scheduling priority, I/O priority and resource limits for a job, as given
+// to the limit builtin. Only what was given is applied.
+struct ResourceLimits {
+  bool has_nice = false;
+  int nice = 0;
+  bool has_ioprio = false;
+  int ioprio = 0; // Class and level, as ioprio_set takes them.
+  std::vector<std::pair<int, rlim_t>> rlimits;
+};
+
+/**
+ * Parses the option at argv[index] and its value into limits, moving index
+ * past them. Returns false if argv[index] is not a limit option, and throws
+ * std::exception if its value is invalid.
+ */
+bool parseLimitOption(char **argv, int argc, int &index,
+                      ResourceLimits &limits);
+// Applies limits to the calling process, for a job that is about to exec.
+bool applyOwnLimits(const ResourceLimits &limits);
+// Applies limits to every process in the process group pgid.
+bool applyGroupLimits(pid_t pgid, const ResourceLimits &limits);
+// The current settings of pid, in the form the options take.
+std::string describeLimits(pid_t pid);
+
+#endif // SMASH_JOBLIMITS_H_
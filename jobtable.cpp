@@ -0,0 +1,183 @@
+#include "jobtable.h"
+#include <algorithm>
+#include <stdlib.h>
+
+/**
+ * Returns the CPU time pid used so far in milliseconds, or 0 if it cannot be
+ * read.
+ */
+static int64_t _cpuMillis(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return 0;
+  }
+  char stat[512];
+  ssize_t length = read(fd, stat, sizeof(stat) - 1);
+  close(fd);
+  if (length <= 0) {
+    return 0;
+  }
+  stat[length] = '\0';
+
+  // The command name may hold spaces, so fields are counted from the state
+  // right after it, which is field 3. utime and stime are 14 and 15.
+  const char *field = strrchr(stat, ')');
+  for (int i = 2; field && i < 14; i++) {
+    field = strchr(field + 1, ' ');
+  }
+  if (!field) {
+    return 0;
+  }
+  char *end;
+  unsigned long long ticks = strtoull(field + 1, &end, 10);
+  ticks += strtoull(end, nullptr, 10);
+  return ticks * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+JobTable::JobTable() : table(nullptr), owner(getpid()) {}
+
+JobTable::~JobTable() {
+  if (!table) {
+    return;
+  }
+  munmap(table, sizeof(JobTableData));
+  if (getpid() == owner) {
+    shm_unlink(name.c_str());
+  }
+}
+
+/**
+ * Creates the table of the shell with pid, empty. Without it nothing is
+ * published.
+ */
+bool JobTable::open(pid_t shellPid) {
+  name = jobTableName(shellPid);
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+  if (fd == -1) {
+    return false;
+  }
+  if (ftruncate(fd, sizeof(JobTableData)) == -1) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void *data = mmap(nullptr, sizeof(JobTableData), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  // The file is zero filled, so every entry starts free.
+  table = (JobTableData *)data;
+  table->shell_pid = shellPid;
+  table->capacity = JOB_TABLE_SIZE;
+  table->version = JOB_TABLE_VERSION;
+  std::atomic_thread_fence(std::memory_order_release);
+  table->magic = JOB_TABLE_MAGIC;
+  owner = getpid();
+  return true;
+}
+
+/**
+ * Adds the job with id, or updates it if it is already in the table.
+ */
+void JobTable::publish(int id, pid_t pid, JobTableState state,
+                       time_t startTime, const std::string &command) {
+  if (!writable()) {
+    return;
+  }
+  int index = findEntry(id);
+  bool added = index == -1;
+  if (added) {
+    index = findEntry(0);
+    if (index == -1) {
+      // Readers are told how many are missing, not just shown fewer.
+      if (left_out.insert(id).second) {
+        beginWrite();
+        table->left_out = left_out.size();
+        endWrite();
+      }
+      return;
+    }
+  }
+  // Sampled before the write, the table is never held for a syscall.
+  int64_t cpu = _cpuMillis(pid);
+
+  beginWrite();
+  JobTableEntry &entry = table->entries[index];
+  entry.id = id;
+  entry.pid = pid;
+  entry.state = state;
+  entry.start_time = startTime;
+  entry.cpu_ms = cpu;
+  size_t length = std::min(command.length(), sizeof(entry.command) - 1);
+  memcpy(entry.command, command.data(), length);
+  entry.command[length] = '\0';
+  if (added) {
+    table->count++;
+    left_out.erase(id);
+    table->left_out = left_out.size();
+  }
+  endWrite();
+}
+
+void JobTable::remove(int id) {
+  if (!writable()) {
+    return;
+  }
+  int index = findEntry(id);
+  if (index == -1) {
+    if (left_out.erase(id)) {
+      beginWrite();
+      table->left_out = left_out.size();
+      endWrite();
+    }
+    return;
+  }
+
+  beginWrite();
+  memset(&table->entries[index], 0, sizeof(JobTableEntry));
+  table->count--;
+  endWrite();
+}
+
+void JobTable::clear() {
+  if (!writable() || (table->count == 0 && left_out.empty())) {
+    return;
+  }
+
+  beginWrite();
+  memset(table->entries, 0, sizeof(table->entries));
+  table->count = 0;
+  table->left_out = 0;
+  endWrite();
+  left_out.clear();
+}
+
+bool JobTable::writable() const { return table && getpid() == owner; }
+
+int JobTable::findEntry(int id) const {
+  for (int i = 0; i < JOB_TABLE_SIZE; i++) {
+    if (table->entries[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void JobTable::beginWrite() {
+  uint32_t sequence = table->sequence.load(std::memory_order_relaxed);
+  table->sequence.store(sequence + 1, std::memory_order_relaxed);
+  // The entries must not be written before readers can see the odd value.
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void JobTable::endWrite() {
+  uint32_t sequence = table->sequence.load(std::memory_order_relaxed);
+  table->sequence.store(sequence + 1, std::memory_order_release);
+}
@@ -0,0 +1,153 @@
+#ifndef SMASH_JOBTABLE_H_
+#define SMASH_JOBTABLE_H_
+
+#include <atomic>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <set>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOB_TABLE_MAGIC (0x544a4d53) // "SMJT"
+#define JOB_TABLE_VERSION (2)
+#define JOB_TABLE_SIZE (128)
+#define JOB_TABLE_COMMAND_SIZE (200)
+
+// The jobs list of a running shell, published in /dev/shm/smash-<pid>.jobs
+// for monitoring tools. The shell is the only writer and updates one entry
+// per job state change. Readers map the file read-only and copy it under a
+// seqlock: the sequence is odd while the shell writes, so a copy is
+// consistent when the sequence was even before it and unchanged after it.
+// Readers never make a syscall or take a lock the shell waits on.
+//
+// Every field has a fixed size, so readers built separately from the shell
+// can use this header as long as magic and version match.
+enum JobTableState : int32_t {
+  JOB_TABLE_RUNNING = 1,
+  JOB_TABLE_STOPPED = 2,
+  JOB_TABLE_KILLED = 3, // Signaled by kill, not reaped yet.
+};
+
+struct JobTableEntry {
+  int32_t id; // 0 for a free entry.
+  int32_t pid;
+  int32_t state;
+  int32_t reserved;
+  int64_t start_time; // Seconds since the epoch.
+  int64_t cpu_ms;     // User and system time as of the last update.
+  char command[JOB_TABLE_COMMAND_SIZE]; // Truncated, NUL terminated.
+};
+
+struct JobTableData {
+  uint32_t magic;
+  uint32_t version;
+  int32_t shell_pid;
+  uint32_t capacity;
+  std::atomic<uint32_t> sequence;
+  uint32_t count; // Used entries.
+  // Jobs that did not fit in the entries, they are in no entry. A job gets
+  // one on its next update, once one is free.
+  uint32_t left_out;
+  JobTableEntry entries[JOB_TABLE_SIZE];
+};
+
+struct JobTableSnapshot {
+  uint32_t sequence; // Grows by 2 with every update.
+  uint32_t count;
+  uint32_t left_out;
+  JobTableEntry entries[JOB_TABLE_SIZE];
+};
+
+/**
+ * Returns the name of the shared memory object of the shell with pid.
+ */
+inline std::string jobTableName(pid_t shellPid) {
+  return "/smash-" + std::to_string(shellPid) + ".jobs";
+}
+
+/**
+ * Maps the job table of the shell with pid read-only. Returns nullptr if
+ * the shell publishes none or it has another layout.
+ */
+inline const JobTableData *jobTableAttach(pid_t shellPid) {
+  int fd = shm_open(jobTableName(shellPid).c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return nullptr;
+  }
+  void *data =
+      mmap(nullptr, sizeof(JobTableData), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  auto table = (const JobTableData *)data;
+  if (table->magic != JOB_TABLE_MAGIC ||
+      table->version != JOB_TABLE_VERSION) {
+    munmap(data, sizeof(JobTableData));
+    return nullptr;
+  }
+  return table;
+}
+
+inline void jobTableDetach(const JobTableData *table) {
+  munmap((void *)table, sizeof(JobTableData));
+}
+
+/**
+ * Copies a consistent view of table into snapshot, retrying while the shell
+ * writes. Returns false if no attempt got one.
+ */
+inline bool jobTableSnapshot(const JobTableData *table,
+                             JobTableSnapshot *snapshot,
+                             int attempts = 1000) {
+  for (int i = 0; i < attempts; i++) {
+    uint32_t before = table->sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    snapshot->count = table->count;
+    snapshot->left_out = table->left_out;
+    memcpy(snapshot->entries, table->entries, sizeof(snapshot->entries));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (table->sequence.load(std::memory_order_relaxed) == before) {
+      snapshot->sequence = before;
+      return true;
+    }
+  }
+  return false;
+}
+
+// The writing side, owned by the shell's jobs list. Forked children share
+// the mapping but never write to it or remove it.
+class JobTable {
+public:
+  JobTable();
+  ~JobTable();
+  JobTable(JobTable const &) = delete;      // disable copy ctor
+  void operator=(JobTable const &) = delete; // disable = operator
+
+  bool open(pid_t shellPid);
+  void publish(int id, pid_t pid, JobTableState state, time_t startTime,
+               const std::string &command);
+  void remove(int id);
+  void clear();
+
+private:
+  bool writable() const;
+  int findEntry(int id) const;
+  void beginWrite();
+  void endWrite();
+
+  JobTableData *table;
+  pid_t owner;
+  std::string name;
+  std::set<int> left_out;
+};
+
+#endif // SMASH_JOBTABLE_H_
@@ -0,0 +1,348 @@
+#include "lineedit.h"
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <signal.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// What ends a word being completed, besides whitespace.
+static const char *WORD_BREAKS = " \t|&<>;";
+
+// The line is UTF-8: the cursor moves, and keys erase, a character at a
+// time, and a character takes one column.
+static bool _isContinuation(char c) { return (c & 0xC0) == 0x80; }
+
+static size_t _previousChar(const std::string &text, size_t pos) {
+  if (pos == 0) {
+    return 0;
+  }
+  pos--;
+  while (pos > 0 && _isContinuation(text[pos])) {
+    pos--;
+  }
+  return pos;
+}
+
+static size_t _nextChar(const std::string &text, size_t pos) {
+  if (pos >= text.length()) {
+    return text.length();
+  }
+  pos++;
+  while (pos < text.length() && _isContinuation(text[pos])) {
+    pos++;
+  }
+  return pos;
+}
+
+// Whether the character that ends at pos has all of its bytes.
+static bool _isComplete(const std::string &text, size_t pos) {
+  size_t start = _previousChar(text, pos);
+  unsigned char lead = text[start];
+  size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+  return pos - start >= length;
+}
+
+static size_t _columns(const std::string &text, size_t from, size_t to) {
+  size_t columns = 0;
+  for (size_t i = from; i < to; i++) {
+    columns += !_isContinuation(text[i]);
+  }
+  return columns;
+}
+
+LineEditor::LineEditor(int fd, std::function<void()> waitForInput,
+                       Completer completer)
+    : fd(fd), wait_for_input(std::move(waitForInput)),
+      completer(std::move(completer)),
+      raw(false), cursor(0) {}
+
+LineEditor::~LineEditor() { leaveRawMode(); }
+
+bool LineEditor::isSupported(int fd) {
+  return isatty(fd) && isatty(STDOUT_FILENO);
+}
+
+LineEditor::Result LineEditor::readLine(const std::string &prompt,
+                                        std::string &outLine) {
+  this->prompt = prompt;
+  line.clear();
+  cursor = 0;
+  escape.clear();
+
+  // Whatever the shell printed goes before the prompt.
+  std::cout.flush();
+  enterRawMode();
+  output(prompt);
+
+  Result result = Result::Line;
+  bool done = false;
+  while (!done) {
+    if (typeahead.empty()) {
+      wait_for_input();
+      char buffer[256];
+      ssize_t res = read(fd, buffer, sizeof(buffer));
+      if (res == -1 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      }
+      if (res <= 0) {
+        result = Result::End;
+        break;
+      }
+      typeahead.assign(buffer, res);
+    }
+
+    size_t used = 0;
+    while (used < typeahead.length() && !done) {
+      done = handleKey(typeahead[used++], result);
+    }
+    typeahead.erase(0, used);
+  }
+
+  leaveRawMode();
+  outLine = line;
+  return result;
+}
+
+bool LineEditor::enterRawMode() {
+  if (raw) {
+    return true;
+  }
+  if (tcgetattr(fd, &original) == -1) {
+    return false;
+  }
+  struct termios settings = original;
+  settings.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  settings.c_iflag &= ~(IXON | ICRNL | INLCR);
+  settings.c_cc[VMIN] = 1;
+  settings.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSADRAIN, &settings) == -1) {
+    return false;
+  }
+  raw = true;
+  return true;
+}
+
+void LineEditor::leaveRawMode() {
+  if (raw) {
+    tcsetattr(fd, TCSADRAIN, &original);
+    raw = false;
+  }
+}
+
+/**
+ * Returns true once key ended the line, with how in outResult.
+ */
+bool LineEditor::handleKey(char key, Result &outResult) {
+  if (!escape.empty()) {
+    escape += key;
+    // ESC [ or ESC O, then parameters, then a final byte from @ to ~.
+    if (escape.length() == 2 && key != '[' && key != 'O') {
+      escape.clear();
+    } else if (escape.length() > 2 && key >= '@' && key <= '~') {
+      handleEscape();
+      escape.clear();
+    }
+    return false;
+  }
+
+  switch (key) {
+  case '\r':
+  case '\n':
+    output("\n");
+    outResult = Result::Line;
+    return true;
+  case CTRL('C'):
+  case CTRL('Z'):
+    output("\n");
+    line.clear();
+    outResult = Result::Interrupted;
+    raise(key == CTRL('C') ? SIGINT : SIGTSTP);
+    return true;
+  case CTRL('D'):
+    if (line.empty()) {
+      outResult = Result::End;
+      return true;
+    }
+    line.erase(cursor, _nextChar(line, cursor) - cursor);
+    break;
+  case '\x7f':
+  case CTRL('H'): {
+    size_t start = _previousChar(line, cursor);
+    line.erase(start, cursor - start);
+    cursor = start;
+    break;
+  }
+  case CTRL('A'):
+    cursor = 0;
+    break;
+  case CTRL('E'):
+    cursor = line.length();
+    break;
+  case CTRL('B'):
+    cursor = _previousChar(line, cursor);
+    break;
+  case CTRL('F'):
+    cursor = _nextChar(line, cursor);
+    break;
+  case CTRL('U'):
+    line.erase(0, cursor);
+    cursor = 0;
+    break;
+  case CTRL('K'):
+    line.erase(cursor);
+    break;
+  case CTRL('W'): {
+    size_t start = cursor;
+    while (start > 0 && line[start - 1] == ' ') {
+      start--;
+    }
+    while (start > 0 && line[start - 1] != ' ') {
+      start--;
+    }
+    line.erase(start, cursor - start);
+    cursor = start;
+    break;
+  }
+  case CTRL('L'):
+    output("\x1b[H\x1b[2J");
+    break;
+  case '\t':
+    complete();
+    break;
+  case '\x1b':
+    escape = key;
+    return false;
+  default:
+    if ((unsigned char)key < ' ') {
+      return false;
+    }
+    line.insert(cursor++, 1, key);
+    if (!_isComplete(line, cursor)) {
+      // The rest of the character is still to come.
+      return false;
+    }
+    break;
+  }
+  redraw();
+  return false;
+}
+
+void LineEditor::handleEscape() {
+  const std::string &keys = escape;
+  if (keys == "\x1b[C" || keys == "\x1bOC") {
+    cursor = _nextChar(line, cursor);
+  } else if (keys == "\x1b[D" || keys == "\x1bOD") {
+    cursor = _previousChar(line, cursor);
+  } else if (keys == "\x1b[H" || keys == "\x1bOH" || keys == "\x1b[1~" ||
+             keys == "\x1b[7~") {
+    cursor = 0;
+  } else if (keys == "\x1b[F" || keys == "\x1bOF" || keys == "\x1b[4~" ||
+             keys == "\x1b[8~") {
+    cursor = line.length();
+  } else if (keys == "\x1b[3~") {
+    line.erase(cursor, _nextChar(line, cursor) - cursor);
+  } else {
+    return;
+  }
+  redraw();
+}
+
+void LineEditor::complete() {
+  size_t start = cursor;
+  while (start > 0 && !strchr(WORD_BREAKS, line[start - 1])) {
+    start--;
+  }
+  std::string word = line.substr(start, cursor - start);
+  size_t before = start;
+  while (before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t')) {
+    before--;
+  }
+  bool command = before == 0 || line[before - 1] == '|';
+
+  std::vector<std::string> matches = completer(word, command);
+  if (matches.empty()) {
+    output("\a");
+    return;
+  }
+
+  std::string common = matches[0];
+  for (auto &&match : matches) {
+    size_t same = 0;
+    while (same < common.length() && same < match.length() &&
+           common[same] == match[same]) {
+      same++;
+    }
+    common.resize(same);
+  }
+  std::string added =
+      common.length() > word.length() ? common.substr(word.length()) : "";
+  if (matches.size() == 1 && common.back() != '/') {
+    added += ' ';
+  }
+  if (added.empty()) {
+    listMatches(matches);
+    return;
+  }
+  line.insert(cursor, added);
+  cursor += added.length();
+}
+
+/**
+ * Prints the matches below the line in columns, then the line again.
+ */
+void LineEditor::listMatches(const std::vector<std::string> &matches) {
+  struct winsize size;
+  size_t width = 80;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+    width = size.ws_col;
+  }
+  size_t shown = std::min<size_t>(matches.size(), LINE_EDITOR_MAX_LISTED);
+  size_t column = 0;
+  for (size_t i = 0; i < shown; i++) {
+    column = std::max(column, _columns(matches[i], 0, matches[i].length()) + 2);
+  }
+  size_t columns = std::max<size_t>(width / column, 1);
+  size_t rows = (shown + columns - 1) / columns;
+
+  std::string text = "\n";
+  for (size_t row = 0; row < rows; row++) {
+    for (size_t i = row; i < shown; i += rows) {
+      std::string match = matches[i];
+      if (i + rows < shown) {
+        match.append(column - _columns(match, 0, match.length()), ' ');
+      }
+      text += match;
+    }
+    text += '\n';
+  }
+  if (shown < matches.size()) {
+    text += "... and " + std::to_string(matches.size() - shown) + " more\n";
+  }
+  output(text);
+}
+
+void LineEditor::redraw() {
+  std::string text = "\r" + prompt + line + "\x1b[K";
+  size_t after = _columns(line, cursor, line.length());
+  if (after > 0) {
+    text += "\x1b[" + std::to_string(after) + "D";
+  }
+  output(text);
+}
+
+void LineEditor::output(const std::string &text) {
+  size_t written = 0;
+  while (written < text.length()) {
+    ssize_t res =
+        write(STDOUT_FILENO, text.data() + written, text.length() - written);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1) {
+      return;
+    }
+    written += res;
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef SMASH_LINEEDIT_H_
+#define SMASH_LINEEDIT_H_
+
+#include <functional>
+#include <string>
+#include <termios.h>
+#include <vector>
+
+#define LINE_EDITOR_MAX_LISTED (100)
+
+// Reads lines from a terminal a key at a time. The arrows, Home and End,
+// ctrl-A and ctrl-E move the cursor, backspace, Delete, ctrl-U, ctrl-K and
+// ctrl-W erase, and Tab completes the word before the cursor: as far as
+// all of its completions agree, or lists them when that adds nothing. The
+// line is UTF-8 and redrawn on one row, it is not wrapped.
+//
+// The terminal is only raw while a line is read, commands run with the
+// settings it had. ctrl-C and ctrl-Z are keys then, they drop the line and
+// are raised, so the shell reports them as it does for a command.
+class LineEditor {
+public:
+  enum class Result { Line, Interrupted, End };
+  // Every word the word could become, command when it is in a command's
+  // place: first on the line or after a pipe.
+  typedef std::function<std::vector<std::string>(const std::string &word,
+                                                 bool command)>
+      Completer;
+
+  // waitForInput returns once fd is readable, running the shell's events
+  // meanwhile.
+  LineEditor(int fd, std::function<void()> waitForInput, Completer completer);
+  ~LineEditor();
+  LineEditor(LineEditor const &) = delete;     // disable copy ctor
+  void operator=(LineEditor const &) = delete; // disable = operator
+
+  // Whether fd and stdout are both a terminal.
+  static bool isSupported(int fd);
+  // Prints the prompt and reads a line. End is for ctrl-D on an empty line
+  // or a terminal that went away.
+  Result readLine(const std::string &prompt, std::string &outLine);
+
+private:
+  bool enterRawMode();
+  void leaveRawMode();
+  bool handleKey(char key, Result &outResult);
+  void handleEscape();
+  void complete();
+  void listMatches(const std::vector<std::string> &matches);
+  void redraw();
+  void output(const std::string &text);
+
+  int fd;
+  std::function<void()> wait_for_input;
+  Completer completer;
+  struct termios original;
+  bool raw;
+  std::string prompt;
+  std::string line;
+  size_t cursor;
+  // An escape sequence read so far, and keys read past the end of a line.
+  std::string escape;
+  std::string typeahead;
+};
+
+#endif // SMASH_LINEEDIT_H_
@@ -0,0 +1,82 @@
+#ifndef SMASH_LRU_CACHE_H_
+#define SMASH_LRU_CACHE_H_
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#define LRU_CACHE_DEFAULT_SIZE (64)
+
+// Maps strings to values, dropping the least recently used entry once more
+// than `capacity` are stored. A capacity of 0 stores nothing.
+template <class V> class LruCache {
+public:
+  explicit LruCache(size_t capacity) : capacity(capacity), hits(0), misses(0) {}
+
+  // The cached value, nullptr on a miss. Stays valid until the next put.
+  const V *get(const std::string &key) {
+    auto it = index.find(key);
+    if (it == index.end()) {
+      misses++;
+      return nullptr;
+    }
+
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return &it->second->second;
+  }
+
+  void put(const std::string &key, const V &value) {
+    if (capacity == 0) {
+      return;
+    }
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+      it->second->second = value;
+      entries.splice(entries.begin(), entries, it->second);
+      return;
+    }
+
+    entries.emplace_front(key, value);
+    index[key] = entries.begin();
+    evict();
+  }
+
+  void clear() {
+    entries.clear();
+    index.clear();
+    hits = 0;
+    misses = 0;
+  }
+
+  void setCapacity(size_t capacity) {
+    this->capacity = capacity;
+    evict();
+  }
+
+  size_t getCapacity() const { return capacity; }
+  size_t getSize() const { return entries.size(); }
+  unsigned long getHits() const { return hits; }
+  unsigned long getMisses() const { return misses; }
+
+private:
+  typedef std::list<std::pair<std::string, V>> Entries;
+
+  void evict() {
+    while (entries.size() > capacity) {
+      index.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+
+  size_t capacity;
+  unsigned long hits;
+  unsigned long misses;
+  // Most recently used first.
+  Entries entries;
+  std::unordered_map<std::string, typename Entries::iterator> index;
+};
+
+#endif // SMASH_LRU_CACHE_H_
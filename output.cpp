@@ -0,0 +1,63 @@
+#include "output.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+FdOutputBuffer::FdOutputBuffer(int fd, size_t capacity)
+    : fd(fd), buffer(capacity) {
+  setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+FdOutputBuffer::~FdOutputBuffer() { flushBuffer(); }
+
+FdOutputBuffer::int_type FdOutputBuffer::overflow(int_type ch) {
+  if (!flushBuffer()) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+std::streamsize FdOutputBuffer::xsputn(const char *s, std::streamsize n) {
+  if (n > epptr() - pptr()) {
+    if (!flushBuffer()) {
+      return 0;
+    }
+    // Too big to ever fit, skip the copy and write it as is.
+    if (n >= (std::streamsize)buffer.size()) {
+      return writeAll(s, n) ? n : 0;
+    }
+  }
+  memcpy(pptr(), s, n);
+  pbump((int)n);
+  return n;
+}
+
+int FdOutputBuffer::sync() { return flushBuffer() ? 0 : -1; }
+
+bool FdOutputBuffer::flushBuffer() {
+  size_t pending = pptr() - pbase();
+  setp(buffer.data(), buffer.data() + buffer.size());
+  if (pending == 0) {
+    return true;
+  }
+  return writeAll(buffer.data(), pending);
+}
+
+bool FdOutputBuffer::writeAll(const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
@@ -0,0 +1,32 @@
+#ifndef SMASH_OUTPUT_H_
+#define SMASH_OUTPUT_H_
+
+#include <streambuf>
+#include <vector>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Stream buffer used as std::cout's buffer for builtin output. Output is kept
+// in memory and written to the target file descriptor with a single write(2)
+// when the command ends, when the buffer fills up or before the shell forks.
+class FdOutputBuffer : public std::streambuf {
+public:
+  explicit FdOutputBuffer(int fd, size_t capacity = OUTPUT_BUFFER_SIZE);
+  virtual ~FdOutputBuffer();
+  FdOutputBuffer(FdOutputBuffer const &) = delete; // disable copy ctor
+  void operator=(FdOutputBuffer const &) = delete; // disable = operator
+
+protected:
+  int_type overflow(int_type ch) override;
+  std::streamsize xsputn(const char *s, std::streamsize n) override;
+  int sync() override;
+
+private:
+  bool flushBuffer();
+  bool writeAll(const char *data, size_t length);
+
+  int fd;
+  std::vector<char> buffer;
+};
+
+#endif // SMASH_OUTPUT_H_
@@ -0,0 +1,400 @@
+#include "pathindex.h"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PATH_INDEX_EVENTS                                                      \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |          \
+   IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+// On the parent of a directory that is missing. Added to whatever else the
+// parent is watched for.
+#define PATH_INDEX_PARENT_EVENTS                                               \
+  (IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD)
+
+// The same test resolveCommand makes: a regular file we may execute.
+static bool _isExecutable(int dirFd, const char *name) {
+  struct stat info;
+  return fstatat(dirFd, name, &info, 0) == 0 && S_ISREG(info.st_mode) &&
+         faccessat(dirFd, name, X_OK, 0) == 0;
+}
+
+/**
+ * Appends a "name/index" record, null terminated, for every executable in
+ * path. A name never has a / in it, so the last one ends it.
+ */
+static void _listDirectory(const std::string &path, size_t index,
+                           std::string &out) {
+  DIR *dir = opendir(path.c_str());
+  if (!dir) {
+    return;
+  }
+  std::string suffix = "/" + std::to_string(index);
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+        !_isExecutable(dirfd(dir), entry->d_name)) {
+      continue;
+    }
+    out += entry->d_name;
+    out += suffix;
+    out += '\0';
+  }
+  closedir(dir);
+}
+
+static bool _writeAll(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.length()) {
+    ssize_t res = write(fd, data.data() + written, data.length() - written);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1) {
+      return false;
+    }
+    written += res;
+  }
+  return true;
+}
+
+PathIndex::PathIndex(Reactor &reactor)
+    : reactor(reactor), started(false), inotify_fd(-1), owner(getpid()),
+      lister(-1), listing_fd(-1) {}
+
+PathIndex::~PathIndex() {
+  // A forked command exiting must not kill the shell's lister.
+  if (getpid() == owner) {
+    stop();
+  }
+}
+
+void PathIndex::update(const std::string &path) {
+  if (started && path == this->path) {
+    // Changes may still be queued, the reactor did not run since.
+    if (inotify_fd != -1) {
+      readChanges();
+    }
+    return;
+  }
+  start(path);
+}
+
+void PathIndex::start(const std::string &path) {
+  stop();
+  this->path = path;
+  started = true;
+
+  // Watched before they are listed, so nothing that changes in between is
+  // missed.
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd != -1 &&
+      !reactor.add(inotify_fd, EPOLLIN, [this](uint32_t) { readChanges(); })) {
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  size_t from = 0;
+  while (from <= path.length()) {
+    size_t end = std::min(path.find(':', from), path.length());
+    std::string dir = path.substr(from, end - from);
+    from = end + 1;
+    auto known = [&](const Directory &directory) {
+      return directory.path == dir;
+    };
+    if (dir.empty() || dir[0] != '/' ||
+        std::any_of(directories.begin(), directories.end(), known)) {
+      continue;
+    }
+    int watch = inotify_fd == -1 ? -1
+                                 : inotify_add_watch(inotify_fd, dir.c_str(),
+                                                     PATH_INDEX_EVENTS);
+    if (watch == -1 && inotify_fd != -1 && watchParent(dir)) {
+      // It may have been created in between.
+      watch = inotify_add_watch(inotify_fd, dir.c_str(), PATH_INDEX_EVENTS);
+    }
+    directories.push_back({dir, watch, {}});
+  }
+  if (directories.empty()) {
+    return;
+  }
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    fds[0] = fds[1] = -1;
+  }
+  pid_t pid = fds[0] == -1 ? -1 : fork();
+  if (pid == 0) {
+    close(fds[0]);
+    int null = open("/dev/null", O_RDWR);
+    for (int fd = 0; fd < 3 && null != -1; fd++) {
+      dup2(null, fd);
+    }
+    // Like the fork server's, the lister shares the shell's process group.
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGALRM, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    std::string out;
+    for (size_t i = 0; i < directories.size(); i++) {
+      _listDirectory(directories[i].path, i, out);
+      if (out.length() >= PATH_INDEX_READ_SIZE) {
+        if (!_writeAll(fds[1], out)) {
+          _exit(1);
+        }
+        out.clear();
+      }
+    }
+    _exit(_writeAll(fds[1], out) ? 0 : 1);
+  }
+
+  if (pid == -1) {
+    // Without a lister, the directories are listed right here.
+    if (fds[0] != -1) {
+      close(fds[0]);
+      close(fds[1]);
+    }
+    for (size_t i = 0; i < directories.size(); i++) {
+      _listDirectory(directories[i].path, i, listing);
+    }
+    applyListing();
+    return;
+  }
+  close(fds[1]);
+  lister = pid;
+  listing_fd = fds[0];
+  fcntl(listing_fd, F_SETFL, fcntl(listing_fd, F_GETFL) | O_NONBLOCK);
+  if (!reactor.add(listing_fd, EPOLLIN, [this](uint32_t) { readListing(); })) {
+    // Nothing would ever read it, wait for the whole listing instead.
+    fcntl(listing_fd, F_SETFL, fcntl(listing_fd, F_GETFL) & ~O_NONBLOCK);
+    readListing();
+  }
+}
+
+/**
+ * Watches the parent of a directory that could not be watched, so once it
+ * is created everything is listed again. False if the parent is missing
+ * too, then it is not waited for.
+ */
+bool PathIndex::watchParent(const std::string &dir) {
+  std::string path = dir;
+  while (path.length() > 1 && path.back() == '/') {
+    path.pop_back();
+  }
+  size_t slash = path.rfind('/');
+  std::string parent = slash == 0 ? "/" : path.substr(0, slash);
+  int watch = inotify_add_watch(inotify_fd, parent.c_str(),
+                                PATH_INDEX_PARENT_EVENTS);
+  if (watch == -1) {
+    return false;
+  }
+  missing.emplace_back(watch, path.substr(slash + 1));
+  return true;
+}
+
+void PathIndex::stop() {
+  if (lister != -1) {
+    kill(lister, SIGKILL);
+    while (waitpid(lister, nullptr, 0) == -1 && errno == EINTR) {
+    }
+    lister = -1;
+  }
+  if (listing_fd != -1) {
+    reactor.remove(listing_fd);
+    close(listing_fd);
+    listing_fd = -1;
+  }
+  // Closing it drops every watch.
+  if (inotify_fd != -1) {
+    reactor.remove(inotify_fd);
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  directories.clear();
+  names.clear();
+  listing.clear();
+  pending.clear();
+  missing.clear();
+}
+
+bool PathIndex::isReady() const { return started && listing_fd == -1; }
+
+std::string PathIndex::find(const std::string &name) const {
+  for (auto &&directory : directories) {
+    if (directory.names.count(name)) {
+      return directory.path + "/" + name;
+    }
+  }
+  return "";
+}
+
+std::vector<std::string> PathIndex::findAll(const std::string &name) const {
+  std::vector<std::string> found;
+  for (auto &&directory : directories) {
+    if (directory.names.count(name)) {
+      found.push_back(directory.path + "/" + name);
+    }
+  }
+  return found;
+}
+
+std::vector<std::string> PathIndex::complete(const std::string &prefix) const {
+  std::vector<std::string> matches;
+  for (auto it = names.lower_bound(prefix);
+       it != names.end() && it->first.compare(0, prefix.length(), prefix) == 0;
+       ++it) {
+    matches.push_back(it->first);
+  }
+  return matches;
+}
+
+size_t PathIndex::size() const { return names.size(); }
+
+/**
+ * Called by the reactor while the lister writes. Once it closed the pipe,
+ * the listing is added to the index.
+ */
+void PathIndex::readListing() {
+  char buffer[4096];
+  while (true) {
+    ssize_t res = read(listing_fd, buffer, sizeof(buffer));
+    if (res > 0) {
+      listing.append(buffer, res);
+      continue;
+    }
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1 && errno == EAGAIN) {
+      return;
+    }
+    // End of the listing, or a lister that failed midway: what it did send
+    // is still right.
+    break;
+  }
+
+  reactor.remove(listing_fd);
+  close(listing_fd);
+  listing_fd = -1;
+  while (waitpid(lister, nullptr, 0) == -1 && errno == EINTR) {
+  }
+  lister = -1;
+  applyListing();
+}
+
+void PathIndex::applyListing() {
+  size_t from = 0;
+  while (from < listing.length()) {
+    size_t end = listing.find('\0', from);
+    if (end == std::string::npos) {
+      break;
+    }
+    size_t slash = listing.rfind('/', end);
+    if (slash != std::string::npos && slash > from) {
+      size_t directory = strtoul(listing.c_str() + slash + 1, nullptr, 10);
+      if (directory < directories.size()) {
+        insert(directory, listing.substr(from, slash - from));
+      }
+    }
+    from = end + 1;
+  }
+  listing.clear();
+  listing.shrink_to_fit();
+
+  // The listing may be older than these changes, or newer.
+  for (auto &&change : pending) {
+    recheck(change.first, change.second);
+  }
+  pending.clear();
+}
+
+void PathIndex::readChanges() {
+  // Aligned for the events read into it.
+  alignas(struct inotify_event) char buffer[4096];
+  bool relist = false;
+  while (true) {
+    ssize_t res = read(inotify_fd, buffer, sizeof(buffer));
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      break;
+    }
+
+    const char *end = buffer + res;
+    const struct inotify_event *event;
+    for (const char *next = buffer; next < end;
+         next += sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event *)next;
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Changes were lost, only listing everything again can tell which.
+        relist = true;
+        continue;
+      }
+      for (auto &&awaited : missing) {
+        if (awaited.first == event->wd && event->len > 0 &&
+            (event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+            awaited.second == event->name) {
+          relist = true;
+        }
+      }
+      // The same directory may be in PATH under two names.
+      for (size_t i = 0; i < directories.size(); i++) {
+        if (directories[i].watch != event->wd) {
+          continue;
+        }
+        if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+          // The watch went with the directory, another may be in its
+          // place by now. Starting over watches the path again, or its
+          // parent until it is created.
+          relist = true;
+        } else if (event->len > 0) {
+          if (listing_fd != -1) {
+            pending.emplace_back(i, event->name);
+          } else {
+            recheck(i, event->name);
+          }
+        }
+      }
+    }
+  }
+
+  if (relist) {
+    start(path);
+  }
+}
+
+void PathIndex::recheck(size_t directory, const std::string &name) {
+  std::string file = directories[directory].path + "/" + name;
+  if (_isExecutable(AT_FDCWD, file.c_str())) {
+    insert(directory, name);
+  } else {
+    erase(directory, name);
+  }
+}
+
+void PathIndex::insert(size_t directory, const std::string &name) {
+  if (directories[directory].names.insert(name).second) {
+    names[name]++;
+  }
+}
+
+void PathIndex::erase(size_t directory, const std::string &name) {
+  if (!directories[directory].names.erase(name)) {
+    return;
+  }
+  auto it = names.find(name);
+  if (--it->second == 0) {
+    names.erase(it);
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef SMASH_PATHINDEX_H_
+#define SMASH_PATHINDEX_H_
+
+#include "reactor.h"
+#include <map>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+#define PATH_INDEX_READ_SIZE (64 * 1024)
+
+// The executables in the directories of PATH, sorted by name, so looking a
+// command up or completing one never touches the filesystem.
+//
+// The directories are listed by a forked child, which sends the names back
+// over a pipe the reactor reads, so a slow directory, like one on NFS,
+// never holds up the prompt. Before that, every directory gets an inotify
+// watch, and whatever changes afterwards is applied to the index as it
+// happens. Changes made while the child runs are checked again once its
+// listing is in. A directory that is missing, or gets deleted or moved, is
+// listed again once it is created. Relative directories are not indexed,
+// they change with the working directory.
+class PathIndex {
+public:
+  explicit PathIndex(Reactor &reactor);
+  ~PathIndex();
+  PathIndex(PathIndex const &) = delete;      // disable copy ctor
+  void operator=(PathIndex const &) = delete; // disable = operator
+
+  // Starts indexing the directories of path, unless they are indexed
+  // already, then only the changes queued since are applied. The old index
+  // is dropped right away.
+  void update(const std::string &path);
+  // Whether the directories were listed.
+  bool isReady() const;
+
+  // Where name is found first, "" if it is in none of the directories.
+  std::string find(const std::string &name) const;
+  // Everywhere name is, in the order of PATH.
+  std::vector<std::string> findAll(const std::string &name) const;
+  // The names starting with prefix, sorted.
+  std::vector<std::string> complete(const std::string &prefix) const;
+  // How many distinct names are indexed.
+  size_t size() const;
+
+private:
+  struct Directory {
+    std::string path;
+    int watch; // -1 if it could not be watched.
+    std::set<std::string> names;
+  };
+
+  void start(const std::string &path);
+  void stop();
+  bool watchParent(const std::string &dir);
+  void readListing();
+  void applyListing();
+  void readChanges();
+  void recheck(size_t directory, const std::string &name);
+  void insert(size_t directory, const std::string &name);
+  void erase(size_t directory, const std::string &name);
+
+  Reactor &reactor;
+  bool started;
+  std::string path;
+  std::vector<Directory> directories;
+  // How many directories each name is in.
+  std::map<std::string, int> names;
+  int inotify_fd;
+  pid_t owner;
+  // The child listing the directories, and the names it sent so far.
+  pid_t lister;
+  int listing_fd;
+  std::string listing;
+  // Changes seen while the child ran, checked again once it is done.
+  std::vector<std::pair<size_t, std::string>> pending;
+  // The watch on the parent of every missing directory, and its name.
+  std::vector<std::pair<int, std::string>> missing;
+};
+
+#endif // SMASH_PATHINDEX_H_
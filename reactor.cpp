@@ -0,0 +1,127 @@
+#include "reactor.h"
+#include "Commands.h"
+#include <algorithm>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static long _monotonicMillis() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+Reactor::Reactor() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), generation(0) {}
+
+Reactor::~Reactor() {
+  if (epoll_fd != -1) {
+    close(epoll_fd);
+  }
+}
+
+bool Reactor::add(int fd, uint32_t events, Handler handler) {
+  if (epoll_fd == -1 || fd == -1) {
+    return false;
+  }
+
+  auto watch = std::make_shared<Watch>();
+  watch->generation = ++generation;
+  watch->handler = std::move(handler);
+
+  // The generation goes along with the fd, so an event that was already
+  // returned for a removed fd is never given to a new handler.
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.u64 = (uint64_t)watch->generation << 32 | (uint32_t)fd;
+  int op = watches.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(epoll_fd, op, fd, &event) == -1) {
+    return false;
+  }
+  watches[fd] = watch;
+  return true;
+}
+
+bool Reactor::modify(int fd, uint32_t events) {
+  auto it = watches.find(fd);
+  if (it == watches.end()) {
+    return false;
+  }
+
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.u64 = (uint64_t)it->second->generation << 32 | (uint32_t)fd;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void Reactor::remove(int fd) {
+  if (watches.erase(fd)) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+bool Reactor::isWatched(int fd) const { return watches.count(fd) != 0; }
+
+bool Reactor::runOnce(int timeoutMs) {
+  if (epoll_fd == -1) {
+    errno = EBADF;
+    return false;
+  }
+
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+  int count = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, timeoutMs);
+  if (count == -1) {
+    return errno == EINTR;
+  }
+
+  for (int i = 0; i < count; i++) {
+    int fd = (int)(uint32_t)events[i].data.u64;
+    auto it = watches.find(fd);
+    if (it == watches.end() ||
+        it->second->generation != events[i].data.u64 >> 32) {
+      continue;
+    }
+    // Kept alive by the copy while the handler removes its own fd.
+    std::shared_ptr<Watch> watch = it->second;
+    watch->handler(events[i].events);
+  }
+  return true;
+}
+
+bool Reactor::runUntil(const std::function<bool()> &done, int timeoutMs) {
+  long deadline = _monotonicMillis() + timeoutMs;
+  while (!done()) {
+    int left = -1;
+    if (timeoutMs != -1) {
+      left = std::max(deadline - _monotonicMillis(), 0L);
+    }
+    if (!runOnce(left)) {
+      syscallError("epoll_wait");
+      return false;
+    }
+    // What was ready when the time ran out still counts.
+    if (left == 0 && !done()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+PidWatch::PidWatch(Reactor &reactor, pid_t pid)
+    : reactor(reactor), pidfd((int)syscall(SYS_pidfd_open, pid, 0)) {
+  if (pidfd != -1 && !reactor.add(pidfd, EPOLLIN, [](uint32_t) {})) {
+    close(pidfd);
+    pidfd = -1;
+  }
+}
+
+PidWatch::~PidWatch() { reset(); }
+
+void PidWatch::reset() {
+  if (pidfd != -1) {
+    reactor.remove(pidfd);
+    close(pidfd);
+    pidfd = -1;
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef SMASH_REACTOR_H_
+#define SMASH_REACTOR_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define REACTOR_MAX_EVENTS (64)
+
+// One epoll set for everything the shell waits on: the signal pipe, captured
+// output, the pidfds of background jobs, the input and the control socket's
+// clients. Each watched fd has a handler, called with the epoll events the
+// fd got.
+//
+// The shell never blocks anywhere else. A wait, like the one for a
+// foreground command, runs the reactor until its own condition holds, so
+// the other handlers keep being called in the meantime. Waits nest: a
+// handler may start one of its own, and the innermost one returns first.
+class Reactor {
+public:
+  typedef std::function<void(uint32_t events)> Handler;
+
+  Reactor();
+  ~Reactor();
+  Reactor(Reactor const &) = delete;      // disable copy ctor
+  void operator=(Reactor const &) = delete; // disable = operator
+
+  // Watches fd, replacing its handler if it was watched already.
+  bool add(int fd, uint32_t events, Handler handler);
+  bool modify(int fd, uint32_t events);
+  // Stops watching fd, which has to happen before it is closed. Events fd
+  // got in the same round are dropped, even when removed by a handler.
+  void remove(int fd);
+  bool isWatched(int fd) const;
+
+  // Waits up to timeoutMs (-1 for no limit) for events and calls their
+  // handlers. Returns false if epoll failed.
+  bool runOnce(int timeoutMs);
+  // Runs until done() returns true, which is checked before every wait.
+  // Returns false if timeoutMs passed first or epoll failed.
+  bool runUntil(const std::function<bool()> &done, int timeoutMs = -1);
+
+private:
+  struct Watch {
+    uint32_t generation; // Tells apart the fds a closed one was reused as.
+    Handler handler;
+  };
+
+  int epoll_fd;
+  uint32_t generation;
+  std::map<int, std::shared_ptr<Watch>> watches;
+};
+
+// Wakes the reactor up when pid exits, for as long as it lives. Does
+// nothing if pidfds are unsupported, SIGCHLD still wakes it then.
+class PidWatch {
+public:
+  PidWatch(Reactor &reactor, pid_t pid);
+  ~PidWatch();
+  PidWatch(PidWatch const &) = delete;      // disable copy ctor
+  void operator=(PidWatch const &) = delete; // disable = operator
+
+  // Stops watching, which has to happen once pid is reaped: a pidfd stays
+  // readable after that and would keep the reactor from sleeping.
+  void reset();
+
+private:
+  Reactor &reactor;
+  int pidfd;
+};
+
+#endif // SMASH_REACTOR_H_
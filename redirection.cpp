@@ -0,0 +1,523 @@
+#include "redirection.h"
+#include "Commands.h"
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Saved copies are kept above the fds a command is likely to use.
+#define SAVED_FD_BASE (10)
+
+FdAction FdAction::open(int fd, const std::string &path, int flags) {
+  return FdAction{Type::Open, fd, path, flags, -1};
+}
+
+FdAction FdAction::dup(int fd, int source) {
+  return FdAction{Type::Dup, fd, "", 0, source};
+}
+
+FdAction FdAction::tee(const std::string &path) {
+  return FdAction{Type::Tee, STDOUT_FILENO, path,
+                  O_WRONLY | O_CREAT | O_TRUNC, -1};
+}
+
+FdAction FdAction::data(int fd, const std::string &text) {
+  return FdAction{Type::Data, fd, text, 0, -1};
+}
+
+static bool _isWordEnd(char c) {
+  return isspace(c) || c == '<' || c == '>' || c == '&' || c == '|';
+}
+
+// Reads the word at i, after any spaces, and moves i past it. A word in
+// single or double quotes may hold anything but its quote, which is
+// dropped. Returns "" if there is no word.
+static std::string _readWord(const std::string &cmd_line, size_t &i) {
+  const size_t length = cmd_line.length();
+  while (i < length && isspace(cmd_line[i])) {
+    i++;
+  }
+  if (i < length && (cmd_line[i] == '"' || cmd_line[i] == '\'')) {
+    size_t end = cmd_line.find(cmd_line[i], i + 1);
+    if (end != std::string::npos) {
+      std::string word = cmd_line.substr(i + 1, end - i - 1);
+      i = end + 1;
+      return word;
+    }
+  }
+  size_t start = i;
+  while (i < length && !_isWordEnd(cmd_line[i])) {
+    i++;
+  }
+  return cmd_line.substr(start, i - start);
+}
+
+// Consumes the lines of bodies up to the one that is delimiter, and returns
+// them with their newlines.
+static std::string _takeBody(std::string &bodies,
+                             const std::string &delimiter) {
+  std::string body;
+  size_t start = 0;
+  while (start < bodies.length()) {
+    size_t end = bodies.find('\n', start);
+    if (end == std::string::npos) {
+      end = bodies.length();
+    }
+    std::string line = bodies.substr(start, end - start);
+    start = std::min(end + 1, bodies.length());
+    if (line == delimiter) {
+      break;
+    }
+    body += line;
+    body += '\n';
+  }
+  bodies.erase(0, start);
+  return body;
+}
+
+bool parseRedirections(const std::string &cmd_line, std::string &outCommand,
+                       RedirectionPlan &outPlan, std::string *bodies) {
+  std::string command;
+  const size_t length = cmd_line.length();
+  size_t i = 0;
+
+  while (i < length) {
+    size_t start = i;
+    bool tokenStart = i == 0 || isspace(cmd_line[i - 1]);
+    int fd = -1;
+    bool both = false;
+
+    // Optional "N" or "&" in front of the operator.
+    if (tokenStart && isdigit(cmd_line[i]) && i + 1 < length &&
+        (cmd_line[i + 1] == '<' || cmd_line[i + 1] == '>')) {
+      fd = cmd_line[i] - '0';
+      i++;
+    } else if (cmd_line[i] == '&' && i + 1 < length && cmd_line[i + 1] == '>') {
+      both = true;
+      i++;
+    }
+
+    char op = cmd_line[i];
+    if (op != '<' && op != '>') {
+      command += cmd_line[start];
+      i = start + 1;
+      continue;
+    }
+    i++;
+
+    // <<< word and << WORD, the text goes into a memfd when applied.
+    if (op == '<' && !both && i < length && cmd_line[i] == '<') {
+      i++;
+      bool hereString = i < length && cmd_line[i] == '<';
+      if (hereString) {
+        i++;
+      }
+      std::string word = _readWord(cmd_line, i);
+      if (word.empty() || (!hereString && !bodies)) {
+        return false;
+      }
+      outPlan.push_back(
+          FdAction::data(fd == -1 ? STDIN_FILENO : fd,
+                         hereString ? word + "\n" : _takeBody(*bodies, word)));
+      command += ' ';
+      continue;
+    }
+
+    bool append = false;
+    bool tee = false;
+    if (op == '>' && i < length && cmd_line[i] == '>') {
+      append = true;
+      i++;
+    } else if (op == '>' && fd == -1 && !both && i < length &&
+               cmd_line[i] == '|') {
+      tee = true;
+      i++;
+    }
+    if (fd == -1) {
+      fd = op == '<' ? 0 : 1;
+    }
+
+    // N>&M and N<&M duplicate an existing fd.
+    if (!both && !append && i < length && cmd_line[i] == '&') {
+      i++;
+      size_t digits = i;
+      while (i < length && isdigit(cmd_line[i])) {
+        i++;
+      }
+      if (digits == i) {
+        return false;
+      }
+      // An fd past what an int holds is just as invalid as a missing one.
+      errno = 0;
+      long source = strtol(cmd_line.c_str() + digits, nullptr, 10);
+      if (errno == ERANGE || source > INT_MAX) {
+        return false;
+      }
+      outPlan.push_back(FdAction::dup(fd, (int)source));
+      command += ' ';
+      continue;
+    }
+
+    while (i < length && isspace(cmd_line[i])) {
+      i++;
+    }
+    size_t pathStart = i;
+    while (i < length && !_isWordEnd(cmd_line[i])) {
+      i++;
+    }
+    if (pathStart == i) {
+      return false;
+    }
+
+    std::string path = cmd_line.substr(pathStart, i - pathStart);
+    if (tee) {
+      outPlan.push_back(FdAction::tee(path));
+      command += ' ';
+      continue;
+    }
+
+    int flags = op == '<' ? O_RDONLY
+                          : O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+    outPlan.push_back(FdAction::open(fd, path, flags));
+    if (both) {
+      outPlan.push_back(FdAction::dup(STDERR_FILENO, STDOUT_FILENO));
+    }
+    command += ' ';
+  }
+
+  outCommand = command;
+  return true;
+}
+
+std::vector<std::string> hereDocumentDelimiters(const std::string &cmd_line) {
+  std::vector<std::string> delimiters;
+  size_t i = 0;
+  while ((i = cmd_line.find("<<", i)) != std::string::npos) {
+    i += 2;
+    if (i < cmd_line.length() && cmd_line[i] == '<') {
+      // A here-string, its word may be quoted.
+      i++;
+      _readWord(cmd_line, i);
+      continue;
+    }
+    std::string word = _readWord(cmd_line, i);
+    if (!word.empty()) {
+      delimiters.push_back(word);
+    }
+  }
+  return delimiters;
+}
+
+int openHereDocument(const std::string &text) {
+  int fd = memfd_create("smash-here-document", MFD_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  for (size_t written = 0; written < text.length();) {
+    ssize_t res = write(fd, text.data() + written, text.length() - written);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1) {
+      close(fd);
+      return -1;
+    }
+    written += res;
+  }
+  if (lseek(fd, 0, SEEK_SET) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool extractTeeTargets(RedirectionPlan &plan,
+                       std::vector<std::string> &outPaths) {
+  bool redirectsStdout = false;
+  for (auto &&action : plan) {
+    if (action.type == FdAction::Type::Tee) {
+      outPaths.push_back(action.path);
+    } else if (action.fd == STDOUT_FILENO) {
+      redirectsStdout = true;
+    }
+  }
+  if (outPaths.empty()) {
+    return true;
+  }
+
+  plan.erase(std::remove_if(plan.begin(), plan.end(),
+                            [](const FdAction &action) {
+                              return action.type == FdAction::Type::Tee;
+                            }),
+             plan.end());
+  return !redirectsStdout;
+}
+
+// Moves exactly length bytes out of the pipe source. Uses splice(2) and falls
+// back to read/write for targets splice can not handle.
+static bool _drainPipe(int source, int target, size_t length) {
+  while (length > 0) {
+    ssize_t moved = splice(source, nullptr, target, nullptr, length, 0);
+    if (moved == -1 && errno == EINTR) {
+      continue;
+    }
+    if (moved == -1 && errno == EINVAL) {
+      char buffer[PIPE_BUF * 4];
+      moved = read(source, buffer, std::min(length, sizeof(buffer)));
+      for (ssize_t done = 0; done < moved;) {
+        ssize_t written = write(target, buffer + done, moved - done);
+        if (written == -1 && errno != EINTR) {
+          return false;
+        }
+        done += std::max(written, (ssize_t)0);
+      }
+    }
+    if (moved <= 0) {
+      return false;
+    }
+    length -= moved;
+  }
+  return true;
+}
+
+// Duplicates the first length bytes of the pipe source into the pipe target
+// without consuming them. Returns the amount duplicated, 0 at EOF.
+static ssize_t _teePipe(int source, int target, size_t length) {
+  ssize_t copied;
+  do {
+    copied = tee(source, target, length, 0);
+  } while (copied == -1 && errno == EINTR);
+  return copied;
+}
+
+bool teeOutput(int source, int primary, const std::vector<int> &files) {
+  // Non pipe destinations get their copy through a scratch pipe that is at
+  // least as large as the source, so one tee always fits in it whole.
+  int scratch[2];
+  if (pipe2(scratch, O_CLOEXEC) == -1) {
+    syscallError("pipe");
+    return false;
+  }
+  int capacity = fcntl(source, F_GETPIPE_SZ);
+  if (capacity > 0) {
+    fcntl(scratch[1], F_SETPIPE_SZ, capacity);
+  }
+  const size_t chunk = capacity > 0 ? capacity : INT_MAX;
+
+  struct stat primaryStat;
+  bool primaryIsPipe = primary != -1 && fstat(primary, &primaryStat) == 0 &&
+                       S_ISFIFO(primaryStat.st_mode);
+
+  const char *failed = nullptr;
+  while (!failed) {
+    // The first copy of a round decides how many bytes the round moves, -1
+    // until then.
+    ssize_t length = -1;
+
+    if (primary != -1) {
+      length = _teePipe(source, primaryIsPipe ? primary : scratch[1], chunk);
+      if (length == -1 && errno == EPIPE) {
+        // Nobody reads the primary output anymore, keep filling the files.
+        primary = -1;
+      } else if (length == -1) {
+        failed = "tee";
+      } else if (!primaryIsPipe && !_drainPipe(scratch[0], primary, length)) {
+        failed = "splice";
+      }
+    }
+
+    for (size_t i = 0; !failed && length != 0 && i + 1 < files.size(); i++) {
+      ssize_t copied =
+          _teePipe(source, scratch[1], length == -1 ? chunk : length);
+      if (copied == -1 || (length != -1 && copied != length)) {
+        failed = "tee";
+      } else if (!_drainPipe(scratch[0], files[i], copied)) {
+        failed = "splice";
+      }
+      length = copied;
+    }
+    if (failed || length == 0) {
+      break;
+    }
+
+    // The last file consumes the round's data from the source.
+    if (length == -1) {
+      do {
+        length = splice(source, nullptr, files.back(), nullptr, chunk, 0);
+      } while (length == -1 && errno == EINTR);
+      if (length == -1) {
+        failed = "splice";
+      } else if (length == 0) {
+        break;
+      }
+    } else if (!_drainPipe(source, files.back(), length)) {
+      failed = "splice";
+    }
+  }
+
+  if (failed) {
+    syscallError(failed);
+  }
+  close(scratch[0]);
+  close(scratch[1]);
+  return !failed;
+}
+
+/**
+ * Copies the first length bytes of source into target. sendfile keeps the
+ * data in the kernel, a target it can not write to goes through a buffer.
+ */
+static bool _copyFile(int source, int target, off_t length) {
+  off_t offset = 0;
+  while (offset < length) {
+    ssize_t res = sendfile(target, source, &offset, length - offset);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1 && (errno == EINVAL || errno == ENOSYS)) {
+      break;
+    }
+    if (res <= 0) {
+      return false;
+    }
+  }
+
+  char buffer[4096];
+  while (offset < length) {
+    ssize_t res = pread(source, buffer,
+                        std::min<off_t>(sizeof(buffer), length - offset),
+                        offset);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return false;
+    }
+    for (ssize_t written = 0; written < res;) {
+      ssize_t copied = write(target, buffer + written, res - written);
+      if (copied == -1 && errno == EINTR) {
+        continue;
+      }
+      if (copied == -1) {
+        return false;
+      }
+      written += copied;
+    }
+    offset += res;
+  }
+  return true;
+}
+
+bool copyOutput(int source, int primary, const std::vector<int> &files) {
+  struct stat info;
+  if (fstat(source, &info) == -1) {
+    syscallError("fstat");
+    return false;
+  }
+  // Like teeOutput, the files still get everything when nobody reads the
+  // primary output anymore.
+  if (primary != -1 && !_copyFile(source, primary, info.st_size) &&
+      errno != EPIPE) {
+    syscallError("sendfile");
+    return false;
+  }
+  for (int file : files) {
+    if (!_copyFile(source, file, info.st_size)) {
+      syscallError("sendfile");
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool _applyAction(const FdAction &action) {
+  if (action.type == FdAction::Type::Tee) {
+    // Handled by the shell, see teeOutput.
+    return true;
+  }
+  if (action.type == FdAction::Type::Dup) {
+    if (action.source == action.fd) {
+      return true;
+    }
+    if (dup2(action.source, action.fd) == -1) {
+      syscallError("dup2");
+      return false;
+    }
+    return true;
+  }
+
+  int fd;
+  if (action.type == FdAction::Type::Data) {
+    fd = openHereDocument(action.path);
+    if (fd == -1) {
+      syscallError("memfd_create");
+      return false;
+    }
+  } else {
+    fd = ::open(action.path.c_str(), action.flags, 0666);
+    if (fd == -1) {
+      syscallError("open");
+      return false;
+    }
+  }
+  if (fd != action.fd) {
+    if (dup2(fd, action.fd) == -1) {
+      syscallError("dup2");
+      close(fd);
+      return false;
+    }
+    close(fd);
+  }
+  return true;
+}
+
+bool applyRedirections(const RedirectionPlan &plan) {
+  for (auto &&action : plan) {
+    if (!_applyAction(action)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+SavedFds::~SavedFds() { restore(); }
+
+bool SavedFds::apply(const RedirectionPlan &plan) {
+  for (auto &&action : plan) {
+    bool known = false;
+    for (auto &&entry : saved) {
+      known = known || entry.fd == action.fd;
+    }
+    if (!known) {
+      int copy = fcntl(action.fd, F_DUPFD_CLOEXEC, SAVED_FD_BASE);
+      if (copy == -1 && errno != EBADF) {
+        syscallError("fcntl");
+        return false;
+      }
+      saved.push_back(Saved{action.fd, copy});
+    }
+
+    if (!_applyAction(action)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SavedFds::restore() {
+  for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+    if (it->copy == -1) {
+      close(it->fd);
+    } else {
+      dup2(it->copy, it->fd);
+      close(it->copy);
+    }
+  }
+  saved.clear();
+}
@@ -0,0 +1,91 @@
+#ifndef SMASH_REDIRECTION_H_
+#define SMASH_REDIRECTION_H_
+
+#include <string>
+#include <vector>
+
+// A single step of an fd redirection plan. Steps are applied in order, the
+// same way the shell reads them, so "> file 2>&1" and "2>&1 > file" differ.
+// Tee steps are not applied by the child, the shell copies the command's
+// stdout into their files itself (see extractTeeTargets / teeOutput). Data
+// steps, here-strings and here-documents, give fd a memfd holding the text.
+struct FdAction {
+  enum class Type { Open, Dup, Tee, Data };
+
+  static FdAction open(int fd, const std::string &path, int flags);
+  static FdAction dup(int fd, int source);
+  static FdAction tee(const std::string &path);
+  static FdAction data(int fd, const std::string &text);
+
+  Type type;
+  int fd;           // The fd the command sees.
+  std::string path; // Open, Tee: file to open. Data: the text.
+  int flags;        // Open: flags for open(2).
+  int source;       // Dup: fd to duplicate into fd.
+};
+
+typedef std::vector<FdAction> RedirectionPlan;
+
+// Removes the redirection operators (<, >, >>, N>, N>>, N>&M, N<&M, &>, &>>,
+// >|, <<<, <<) from cmd_line and appends the matching actions to outPlan.
+// A here-string (<<< word, the word may be quoted) reads the word and a
+// newline. A here-document (<< WORD) reads the lines at the start of bodies
+// up to the one that is WORD, or all of them, and consumes them. Returns
+// false if an operator is missing its target.
+bool parseRedirections(const std::string &cmd_line, std::string &outCommand,
+                       RedirectionPlan &outPlan,
+                       std::string *bodies = nullptr);
+
+// The delimiters of the here-documents cmd_line opens, in order. Their
+// bodies follow the line, each on lines of its own.
+std::vector<std::string> hereDocumentDelimiters(const std::string &cmd_line);
+
+// Returns a memfd holding text with its offset at the start, -1 on error.
+// Nothing touches the disk, and however large the text is, nobody has to
+// feed it to the reader the way a pipe would need.
+int openHereDocument(const std::string &text);
+
+// Applies the plan to the calling process. Used by forked children right
+// before exec. Reports the failing syscall and returns false on error.
+bool applyRedirections(const RedirectionPlan &plan);
+
+// Moves the tee targets out of the plan into outPaths. Returns false if the
+// plan also redirects stdout some other way, since the tee already owns it.
+bool extractTeeTargets(RedirectionPlan &plan,
+                       std::vector<std::string> &outPaths);
+
+// Copies everything read from the pipe source into primary and into every
+// file in files until source reaches EOF. The data is moved between pipes
+// and files with tee(2) and splice(2), never through user space, except
+// when primary is something splice can not write to, like a terminal.
+// primary may be -1 to only fill the files. Returns false on error.
+bool teeOutput(int source, int primary, const std::vector<int> &files);
+
+// Copies the whole of the regular file source, like a memfd a builtin's
+// output was kept in, into primary and into every file in files. The
+// shell can not drain a tee pipe while a builtin writes into it, so a
+// builtin's output is tee'd this way. primary may be -1. Returns false on
+// error.
+bool copyOutput(int source, int primary, const std::vector<int> &files);
+
+// Applies a plan to the shell's own fds so builtins can be redirected too.
+// The original fds are saved and put back by restore() (or the destructor).
+class SavedFds {
+public:
+  SavedFds() = default;
+  ~SavedFds();
+  SavedFds(SavedFds const &) = delete;       // disable copy ctor
+  void operator=(SavedFds const &) = delete; // disable = operator
+
+  bool apply(const RedirectionPlan &plan);
+  void restore();
+
+private:
+  struct Saved {
+    int fd;
+    int copy; // -1 if fd was not open.
+  };
+  std::vector<Saved> saved;
+};
+
+#endif // SMASH_REDIRECTION_H_
@@ -0,0 +1,196 @@
+#include "repeat.h"
+#include "Commands.h"
+#include <algorithm>
+#include <deque>
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <poll.h>
+#include <signal.h>
+#include <sstream>
+#include <stdint.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open (434)
+#endif
+
+std::string resolveCommand(const std::string &name, const std::string &path) {
+  if (name.find('/') != std::string::npos) {
+    return name;
+  }
+
+  size_t start = 0;
+  while (start <= path.length()) {
+    size_t end = std::min(path.find(':', start), path.length());
+    std::string dir = path.substr(start, end - start);
+    std::string candidate = (dir.empty() ? "." : dir) + "/" + name;
+    struct stat info;
+    if (stat(candidate.c_str(), &info) == 0 && S_ISREG(info.st_mode) &&
+        access(candidate.c_str(), X_OK) == 0) {
+      return candidate;
+    }
+    start = end + 1;
+  }
+  return "";
+}
+
+static uint64_t _monotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static struct timespec _toTimespec(uint64_t nanos) {
+  struct timespec time;
+  time.tv_sec = nanos / 1000000000ULL;
+  time.tv_nsec = nanos % 1000000000ULL;
+  return time;
+}
+
+/**
+ * Starts a run. The parent is suspended until the child execs, so a vfork
+ * costs the same however much memory the shell has. The child only sets
+ * its death signal, a run outlives neither a killed repeat nor the shell.
+ */
+static pid_t _launch(const char *path, char *const *argv, char *const *envp) {
+  pid_t pid = vfork();
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    execve(path, argv, envp);
+    _exit(127);
+  }
+  return pid;
+}
+
+static std::string _millis(uint64_t nanos) {
+  std::ostringstream text;
+  text << std::fixed << std::setprecision(3) << nanos / 1e6 << " ms";
+  return text.str();
+}
+
+int runRepeat(const RepeatOptions &options, const std::string &path,
+              const std::vector<char *> &argv, char *const *envp) {
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timer == -1) {
+    syscallError("timerfd_create");
+    return 1;
+  }
+  uint64_t interval = options.interval_ms * 1000000ULL;
+  uint64_t start = _monotonicNanos();
+  struct itimerspec spec = {_toTimespec(interval), _toTimespec(start)};
+  if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+    syscallError("timerfd_settime");
+    close(timer);
+    return 1;
+  }
+
+  long ticks = 0;
+  long skipped = 0;
+  int status = 0;
+  // When the ticks of queued runs were due.
+  std::deque<uint64_t> queued;
+  pid_t running = -1;
+  int pidfd = -1;
+  uint64_t runStart = 0;
+  std::vector<uint64_t> runTimes;
+  uint64_t totalDelay = 0;
+  uint64_t maxDelay = 0;
+
+  auto launch = [&](uint64_t scheduled) {
+    runStart = _monotonicNanos();
+    running = _launch(path.c_str(), argv.data(), envp);
+    if (running == -1) {
+      syscallError("vfork");
+      return;
+    }
+    uint64_t delay = runStart > scheduled ? runStart - scheduled : 0;
+    totalDelay += delay;
+    maxDelay = std::max(maxDelay, delay);
+    pidfd = (int)syscall(SYS_pidfd_open, running, 0);
+  };
+
+  auto reap = [&]() {
+    int waitStatus = 0;
+    while (waitpid(running, &waitStatus, 0) == -1 && errno == EINTR) {
+    }
+    runTimes.push_back(_monotonicNanos() - runStart);
+    status = exitStatus(waitStatus);
+    if (pidfd != -1) {
+      close(pidfd);
+    }
+    running = -1;
+    pidfd = -1;
+    if (!queued.empty()) {
+      launch(queued.front());
+      queued.pop_front();
+    }
+  };
+
+  while (options.count == 0 || ticks < options.count || running != -1) {
+    // Without a pidfd there is nothing to poll, the run is waited for.
+    if (running != -1 && pidfd == -1) {
+      reap();
+      continue;
+    }
+    struct pollfd fds[2] = {{timer, POLLIN, 0}, {pidfd, POLLIN, 0}};
+    if (poll(fds, 2, -1) == -1) {
+      if (errno != EINTR) {
+        syscallError("poll");
+        break;
+      }
+      continue;
+    }
+
+    uint64_t expirations = 0;
+    if (fds[0].revents && read(timer, &expirations, sizeof(expirations)) !=
+                              sizeof(expirations)) {
+      expirations = 0;
+    }
+    // More than one when the repeat was stopped or late to read.
+    for (; expirations > 0 && (options.count == 0 || ticks < options.count);
+         expirations--) {
+      uint64_t scheduled = start + ticks * interval;
+      ticks++;
+      if (running == -1) {
+        launch(scheduled);
+      } else if (options.queue) {
+        queued.push_back(scheduled);
+      } else {
+        skipped++;
+      }
+    }
+    if (options.count != 0 && ticks == options.count) {
+      struct itimerspec disarm = {};
+      timerfd_settime(timer, 0, &disarm, nullptr);
+    }
+
+    if (fds[1].revents) {
+      reap();
+    }
+  }
+  close(timer);
+
+  std::cout << "repeat: " << ticks << " ticks, " << runTimes.size()
+            << " runs, " << skipped << " skipped" << '\n';
+  if (!runTimes.empty()) {
+    uint64_t total = 0;
+    for (uint64_t time : runTimes) {
+      total += time;
+    }
+    auto range = std::minmax_element(runTimes.begin(), runTimes.end());
+    std::cout << "run time: min " << _millis(*range.first) << ", avg "
+              << _millis(total / runTimes.size()) << ", max "
+              << _millis(*range.second) << '\n';
+    std::cout << "start delay: avg " << _millis(totalDelay / runTimes.size())
+              << ", max " << _millis(maxDelay) << '\n';
+  }
+  std::cout.flush();
+  return status;
+}
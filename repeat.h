@@ -0,0 +1,35 @@
+#ifndef SMASH_REPEAT_H_
+#define SMASH_REPEAT_H_
+
+#include <string>
+#include <vector>
+
+// How the repeat builtin runs its command.
+struct RepeatOptions {
+  long count = 0; // Ticks to run for, 0 runs until the repeat is killed.
+  long interval_ms = 0;
+  // A tick that comes while the command still runs starts it again once it
+  // exits when queued, otherwise it is skipped.
+  bool queue = false;
+};
+
+/**
+ * Finds the executable file name in the directories of path, the way
+ * execvp would. A name with a slash is used as it is. Returns "" if there
+ * is none.
+ */
+std::string resolveCommand(const std::string &name, const std::string &path);
+
+/**
+ * Runs the executable at path with argv and envp on every tick of a
+ * CLOCK_MONOTONIC timerfd, until options.count ticks went by and the last
+ * run exited, then prints latency statistics. Ticks are absolute times from
+ * the start, so a late tick does not move the ones after it, and ticks
+ * missed while the repeat was stopped are skipped or queued like
+ * overlapping ones. The runs are vforked and killed if the repeat is.
+ * Returns the shell-style status of the last run.
+ */
+int runRepeat(const RepeatOptions &options, const std::string &path,
+              const std::vector<char *> &argv, char *const *envp);
+
+#endif // SMASH_REPEAT_H_
@@ -0,0 +1,287 @@
+#include "server.h"
+#include "Commands.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open (434)
+#endif
+
+ControlServer::ControlServer(SmallShell &smash)
+    : smash(smash), listen_fd(-1), running(nullptr) {}
+
+ControlServer::~ControlServer() {
+  while (!sockets.empty()) {
+    removeClient(sockets.begin()->second);
+  }
+  if (listen_fd != -1) {
+    smash.getReactor()->remove(listen_fd);
+    close(listen_fd);
+    unlink(path.c_str());
+  }
+}
+
+bool ControlServer::listen(const std::string &path) {
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.length() >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  strcpy(address.sun_path, path.c_str());
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1) {
+    return false;
+  }
+
+  // A socket left behind by a previous run would fail the bind.
+  unlink(path.c_str());
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+      ::listen(listen_fd, SOMAXCONN) == -1) {
+    return false;
+  }
+  this->path = path;
+
+  return smash.getReactor()->add(listen_fd, EPOLLIN,
+                                 [this](uint32_t) { accept(); });
+}
+
+void ControlServer::run() {
+  while (smash.isSmashWorking()) {
+    runReady();
+    bool ok = smash.runEvents(
+        [this]() { return !ready.empty() || !smash.isSmashWorking(); });
+    if (!ok) {
+      return;
+    }
+  }
+}
+
+/**
+ * Runs the requests of the clients that got new ones, or whose command
+ * finished.
+ */
+void ControlServer::runReady() {
+  while (!ready.empty() && smash.isSmashWorking()) {
+    auto it = sockets.find(ready.front());
+    ready.pop_front();
+    if (it != sockets.end()) {
+      Client *client = it->second;
+      running = client;
+      runRequests(client);
+      running = nullptr;
+      removeIfDone(client);
+    }
+  }
+}
+
+void ControlServer::accept() {
+  while (true) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EINTR) {
+        syscallError("accept4");
+      }
+      return;
+    }
+
+    Client *client = new Client{fd, "", "", {}, -1, -1, -1, false};
+    auto handler = [this, client](uint32_t events) {
+      if (events & EPOLLOUT) {
+        writeOutput(client);
+      }
+      if (events & ~EPOLLOUT) {
+        readRequests(client);
+      }
+      removeIfDone(client);
+    };
+    if (!smash.getReactor()->add(fd, EPOLLIN, handler)) {
+      syscallError("epoll_ctl");
+      close(fd);
+      delete client;
+      continue;
+    }
+    sockets[fd] = client;
+  }
+}
+
+void ControlServer::readRequests(Client *client) {
+  char buffer[4096];
+  while (true) {
+    ssize_t res = read(client->fd, buffer, sizeof(buffer));
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1 && errno == EAGAIN) {
+      break;
+    }
+    if (res <= 0) {
+      client->closed = true;
+      break;
+    }
+    client->input.append(buffer, res);
+  }
+
+  size_t end;
+  while ((end = client->input.find('\n')) != std::string::npos) {
+    client->requests.push_back(client->input.substr(0, end));
+    client->input.erase(0, end + 1);
+  }
+
+  if (!client->requests.empty()) {
+    ready.push_back(client->fd);
+  }
+}
+
+/**
+ * Runs the client's requests in order, until one of them is an external
+ * command that has to be waited for.
+ */
+void ControlServer::runRequests(Client *client) {
+  while (client->pid == -1 && !client->requests.empty() &&
+         smash.isSmashWorking()) {
+    std::string line = client->requests.front();
+    client->requests.pop_front();
+
+    client->output_fd = memfd_create("smash-reply", MFD_CLOEXEC);
+    if (client->output_fd == -1) {
+      syscallError("memfd_create");
+      reply(client, 1);
+      continue;
+    }
+
+    // The command, and whatever it forks, writes into the memfd.
+    pid_t pid;
+    {
+      SavedFds saved;
+      RedirectionPlan plan = {
+          FdAction::dup(STDOUT_FILENO, client->output_fd),
+          FdAction::dup(STDERR_FILENO, client->output_fd)};
+      if (!saved.apply(plan)) {
+        reply(client, 1);
+        continue;
+      }
+      pid = smash.startCommand(line.c_str());
+    }
+
+    if (pid == -1) {
+      reply(client, smash.getLastStatus());
+      continue;
+    }
+
+    client->pid = pid;
+    client->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    auto handler = [this, client](uint32_t) {
+      finishChild(client);
+      removeIfDone(client);
+    };
+    if (!smash.getReactor()->add(client->pidfd, EPOLLIN, handler)) {
+      // Nothing would tell when it exits, so wait for it right here.
+      finishChild(client);
+    }
+  }
+}
+
+void ControlServer::finishChild(Client *client) {
+  int waitStatus = 0;
+  while (waitpid(client->pid, &waitStatus, 0) == -1 && errno == EINTR) {
+  }
+  traceInstant("process", "reap", client->pid);
+  if (client->pidfd != -1) {
+    smash.getReactor()->remove(client->pidfd);
+    close(client->pidfd);
+  }
+  client->pid = -1;
+  client->pidfd = -1;
+
+  reply(client, exitStatus(waitStatus));
+  if (!client->requests.empty()) {
+    ready.push_back(client->fd);
+  }
+}
+
+void ControlServer::reply(Client *client, int status) {
+  std::string output;
+  if (client->output_fd != -1) {
+    off_t size = lseek(client->output_fd, 0, SEEK_END);
+    output.resize(size > 0 ? size : 0);
+    if (pread(client->output_fd, &output[0], output.size(), 0) !=
+        (ssize_t)output.size()) {
+      output.clear();
+    }
+    close(client->output_fd);
+    client->output_fd = -1;
+  }
+
+  client->output += std::to_string(status) + " " +
+                    std::to_string(output.size()) + "\n" + output;
+  writeOutput(client);
+}
+
+/**
+ * Writes as much of the pending replies as the socket takes, and asks for
+ * EPOLLOUT only while something is left.
+ */
+void ControlServer::writeOutput(Client *client) {
+  while (!client->output.empty()) {
+    ssize_t res = write(client->fd, client->output.data(),
+                        client->output.size());
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1 && errno == EAGAIN) {
+      break;
+    }
+    if (res == -1) {
+      // The client is gone, nobody reads the replies anymore.
+      client->output.clear();
+      client->closed = true;
+      break;
+    }
+    client->output.erase(0, res);
+  }
+
+  // A client that hung up would keep reporting EOF.
+  uint32_t events = 0;
+  if (!client->closed) {
+    events |= EPOLLIN;
+  }
+  if (!client->output.empty()) {
+    events |= EPOLLOUT;
+  }
+  smash.getReactor()->modify(client->fd, events);
+}
+
+/**
+ * Drops a client that hung up once it has nothing left running or to send.
+ */
+void ControlServer::removeIfDone(Client *client) {
+  if (client->closed && client->pid == -1 && client->output.empty() &&
+      client != running) {
+    removeClient(client);
+  }
+}
+
+void ControlServer::removeClient(Client *client) {
+  if (client->pidfd != -1) {
+    smash.getReactor()->remove(client->pidfd);
+    close(client->pidfd);
+  }
+  if (client->output_fd != -1) {
+    close(client->output_fd);
+  }
+  sockets.erase(client->fd);
+  smash.getReactor()->remove(client->fd);
+  close(client->fd);
+  delete client;
+}
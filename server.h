@@ -0,0 +1,69 @@
+#ifndef SMASH_SERVER_H_
+#define SMASH_SERVER_H_
+
+#include <deque>
+#include <map>
+#include <string>
+#include <sys/types.h>
+
+class SmallShell;
+
+// Serves command lines to clients connected to a Unix domain socket. A
+// request is a command line ending with '\n'. Each request is answered with
+// a header line "<status> <length>\n" followed by <length> bytes of
+// everything the command wrote to stdout and stderr, and every client gets
+// its answers in the order of its requests.
+//
+// All of it runs on the shell's reactor. Requests are only run from the top
+// of the loop, so builtins, which may change the shell, run one at a time;
+// while one of them waits, like fg does, the other clients are still read
+// from and answered. A foreground external command is only started and is
+// answered once its pidfd reports that it exited, so the commands of
+// different clients overlap.
+class ControlServer {
+public:
+  explicit ControlServer(SmallShell &smash);
+  ~ControlServer();
+  ControlServer(ControlServer const &) = delete;     // disable copy ctor
+  void operator=(ControlServer const &) = delete; // disable = operator
+
+  bool listen(const std::string &path);
+  void run();
+
+private:
+  struct Client {
+    int fd;
+    std::string input;
+    std::string output;
+    std::deque<std::string> requests;
+    // The external command being waited for, -1 if there is none.
+    pid_t pid;
+    int pidfd;
+    // Holds the output of the request being run.
+    int output_fd;
+    bool closed;
+  };
+
+  void accept();
+  void readRequests(Client *client);
+  void runRequests(Client *client);
+  void finishChild(Client *client);
+  void runReady();
+  void reply(Client *client, int status);
+  void writeOutput(Client *client);
+  void removeIfDone(Client *client);
+  void removeClient(Client *client);
+
+  SmallShell &smash;
+  std::string path;
+  int listen_fd;
+  std::map<int, Client *> sockets;
+  // Sockets of clients with requests to run, they run once the reactor
+  // returns to the loop.
+  std::deque<int> ready;
+  // The client whose request runs, it stays around until the request is
+  // done even if it hangs up meanwhile.
+  Client *running;
+};
+
+#endif // SMASH_SERVER_H_
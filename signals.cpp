@@ -1,31 +1,133 @@
 #include "signals.h"
-#include "Commands.h"
-#include "assert.h"
-#include <iostream>
+#include "trace.h"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
-using namespace std;
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_BOOL_LOCK_FREE == 2,
+              "the signal handler needs lock-free atomics");
 
-void ctrlZHandler(int sig_num) {
-  SmallShell::getInstance().stopCurrentCommand();
+static int signalEvents[2] = {-1, -1};
+
+// Single-producer single-consumer ring. The handler only moves head and the
+// main loop only moves tail, so neither side ever waits for the other.
+static SignalEvent ring[SIGNAL_RING_SIZE];
+static std::atomic<unsigned> ringHead(0);
+static std::atomic<unsigned> ringTail(0);
+static std::atomic<unsigned> ringDropped(0);
+
+static std::atomic<bool> childChanged(false);
+static volatile sig_atomic_t foregroundPid = -1;
+
+static SignalStats stats = {};
+
+static long long _monotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
-void ctrlCHandler(int sig_num) {
-  SmallShell::getInstance().killCurrentCommand();
+static const char *_signalName(int sig_num) {
+  switch (sig_num) {
+  case SIGINT:
+    return "SIGINT";
+  case SIGTSTP:
+    return "SIGTSTP";
+  case SIGALRM:
+    return "SIGALRM";
+  case SIGCHLD:
+    return "SIGCHLD";
+  }
+  return "signal";
 }
 
-void alarmHandler(int sig_num, siginfo_t *info, void *) {
-  cout << "smash: got an alarm" << endl;
-  SmallShell &smash = SmallShell::getInstance();
-  pid_t pid = info->si_pid;
-  std::string command_line;
-  if (smash.getCurrentCommandPid() == pid) {
-    command_line = smash.getCurrentCommand()->getCommandLine();
+void signalHandler(int sig_num, siginfo_t *info, void *) {
+  int savedErrno = errno;
+  traceInstant("signal", _signalName(sig_num), info->si_pid);
+
+  if (sig_num == SIGCHLD) {
+    // Nothing to queue, the jobs list only needs to know it should look.
+    childChanged.store(true, std::memory_order_release);
   } else {
-    auto job = smash.getJobList()->getJobByPid(pid);
-    assert(job == nullptr);
-    command_line = job->command->getCommandLine();
+    SignalEvent event = {sig_num, -1, _monotonicNanos()};
+    if (sig_num == SIGALRM) {
+      event.pid = info->si_pid;
+    } else if (foregroundPid != -1) {
+      // Forwarded right away, the main loop may be busy copying the
+      // command's output and only get to the event once it is done.
+      event.pid = foregroundPid;
+      kill(event.pid, sig_num == SIGINT ? SIGKILL : SIGSTOP);
+    }
+
+    unsigned head = ringHead.load(std::memory_order_relaxed);
+    if (head - ringTail.load(std::memory_order_acquire) == SIGNAL_RING_SIZE) {
+      ringDropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      ring[head % SIGNAL_RING_SIZE] = event;
+      ringHead.store(head + 1, std::memory_order_release);
+    }
   }
-  kill(pid, SIGKILL);
-  std::cout << "smash: " << command_line << " timed out!" << std::endl;
+
+  char wakeup = 0;
+  // A full pipe already holds a wakeup, so a failed write loses nothing.
+  ssize_t written = write(signalEvents[1], &wakeup, 1);
+  (void)written;
+  errno = savedErrno;
+}
+
+bool openSignalEvents() {
+  return pipe2(signalEvents, O_CLOEXEC | O_NONBLOCK) == 0;
+}
+
+bool installSignalHandler(int sig_num) {
+  struct sigaction action = {};
+  action.sa_sigaction = signalHandler;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaddset(&action.sa_mask, SIGINT);
+  sigaddset(&action.sa_mask, SIGTSTP);
+  sigaddset(&action.sa_mask, SIGALRM);
+  sigaddset(&action.sa_mask, SIGCHLD);
+  return sigaction(sig_num, &action, nullptr) == 0;
+}
+
+int getSignalEventFd() { return signalEvents[0]; }
+
+void clearSignalEvents() {
+  char events[64];
+  while (read(signalEvents[0], events, sizeof(events)) > 0) {
+  }
+}
+
+bool popSignalEvent(SignalEvent *event) {
+  unsigned tail = ringTail.load(std::memory_order_relaxed);
+  if (tail == ringHead.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  *event = ring[tail % SIGNAL_RING_SIZE];
+  ringTail.store(tail + 1, std::memory_order_release);
+
+  long long latency = _monotonicNanos() - event->time;
+  stats.handled++;
+  stats.total_latency += latency;
+  if (latency > stats.max_latency) {
+    stats.max_latency = latency;
+  }
+  return true;
+}
+
+bool takeChildChanged() {
+  return childChanged.exchange(false, std::memory_order_acquire);
+}
+
+void setForegroundPid(pid_t pid) { foregroundPid = pid; }
+
+SignalStats getSignalStats() {
+  SignalStats current = stats;
+  current.dropped = ringDropped.load(std::memory_order_relaxed);
+  return current;
 }
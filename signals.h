@@ -1,9 +1,52 @@
 #ifndef SMASH__SIGNALS_H_
 #define SMASH__SIGNALS_H_
 #include <signal.h>
+#include <sys/types.h>
 
-void ctrlZHandler(int sig_num);
-void ctrlCHandler(int sig_num);
-void alarmHandler(int sig_num, siginfo_t *info, void *);
+#define SIGNAL_RING_SIZE (64)
+
+// What the signal handler leaves behind for the main loop to act on.
+struct SignalEvent {
+  int signo;
+  // The foreground process ctrl-C/ctrl-Z was forwarded to, or the sender of
+  // an alarm. -1 if there was none.
+  pid_t pid;
+  // CLOCK_MONOTONIC time the signal arrived at, in nanoseconds.
+  long long time;
+};
+
+struct SignalStats {
+  unsigned long handled;
+  unsigned long dropped;
+  // Time from the handler to the main loop acting on the event, in
+  // nanoseconds.
+  long long total_latency;
+  long long max_latency;
+};
+
+/**
+ * Handles SIGINT, SIGTSTP, SIGALRM and SIGCHLD. Everything it does is
+ * async-signal-safe: ctrl-C/ctrl-Z are forwarded to the foreground process
+ * with kill(), then an event is pushed into a ring and a byte is written to
+ * the wakeup pipe. Anything else is up to the main loop.
+ */
+void signalHandler(int sig_num, siginfo_t *info, void *);
+
+// Creates the wakeup pipe the handler writes to.
+bool openSignalEvents();
+// Installs signalHandler for sig_num. All the handled signals mask each
+// other, so the ring only ever has one producer running.
+bool installSignalHandler(int sig_num);
+// Read end of the wakeup pipe, -1 if it was not opened.
+int getSignalEventFd();
+// Empties the wakeup pipe.
+void clearSignalEvents();
+// Pops the oldest event into event, false if there is none.
+bool popSignalEvent(SignalEvent *event);
+// Whether a SIGCHLD arrived since the last call.
+bool takeChildChanged();
+// The process ctrl-C/ctrl-Z are forwarded to, -1 for none.
+void setForegroundPid(pid_t pid);
+SignalStats getSignalStats();
 
 #endif // SMASH__SIGNALS_H_
@@ -1,4 +1,6 @@
 #include "Commands.h"
+#include "lineedit.h"
+#include "server.h"
 #include "signals.h"
 #include <iostream>
 #include <signal.h>
@@ -6,28 +8,92 @@
 #include <unistd.h>
 
 int main(int argc, char *argv[]) {
-  if (signal(SIGTSTP, ctrlZHandler) == SIG_ERR) {
+  // Lets the shell see how much input std::cin already buffered.
+  std::ios::sync_with_stdio(false);
+
+  if (!openSignalEvents()) {
+    perror("smash error: failed to open signal events");
+  }
+  if (!installSignalHandler(SIGTSTP)) {
     perror("smash error: failed to set ctrl-Z handler");
   }
-  if (signal(SIGINT, ctrlCHandler) == SIG_ERR) {
+  if (!installSignalHandler(SIGINT)) {
     perror("smash error: failed to set ctrl-C handler");
   }
-
-  struct sigaction siga;
-  siga.sa_sigaction = alarmHandler;
-  siga.sa_flags |= SA_SIGINFO;
-  if (sigaction(SIGALRM, &siga, nullptr) == -1) {
+  if (!installSignalHandler(SIGALRM)) {
     perror("smash error: failed to set alarm handler");
   }
-
-  // TODO: setup sig alarm handler
+  if (!installSignalHandler(SIGCHLD)) {
+    perror("smash error: failed to set child handler");
+  }
+  // Writing to a pipe nobody reads should fail the write, not kill smash.
+  if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+    perror("smash error: failed to ignore SIGPIPE");
+  }
 
   SmallShell &smash = SmallShell::getInstance();
+  if (argc == 3 && std::string(argv[1]) == "--listen") {
+    ControlServer server(smash);
+    if (!server.listen(argv[2])) {
+      perror("smash error: failed to listen");
+      return 1;
+    }
+    server.run();
+    return 0;
+  }
+
+  // A terminal gets the line editor, anything else is read line by line.
+  LineEditor editor(
+      STDIN_FILENO, [&smash]() { smash.waitForInput(); },
+      [&smash](const std::string &word, bool command) {
+        return smash.completeWord(word, command);
+      });
+  bool interactive = LineEditor::isSupported(STDIN_FILENO);
+  bool interrupted = false;
+  // False at the end of input. A line dropped by ctrl-C or ctrl-Z sets
+  // interrupted, once the shell reported it.
+  auto readLine = [&](const std::string &prompt, std::string &outLine) {
+    interrupted = false;
+    if (!interactive) {
+      std::cout << prompt;
+      std::cout.flush();
+      smash.waitForInput();
+      return (bool)std::getline(std::cin, outLine);
+    }
+    LineEditor::Result result = editor.readLine(prompt, outLine);
+    if (result == LineEditor::Result::Interrupted) {
+      smash.processSignalEvents();
+      interrupted = true;
+    }
+    return result != LineEditor::Result::End;
+  };
+
   while (smash.isSmashWorking()) {
-    std::cout << smash.getDisplayPrompt() << "> ";
+    // What was typed is in the file before the next prompt, other shells
+    // and a crash see it.
+    smash.getHistory()->flush();
     std::string cmd_line;
-    std::getline(std::cin, cmd_line);
-    smash.executeCommand(cmd_line.c_str());
+    if (!readLine(smash.getDisplayPrompt() + "> ", cmd_line)) {
+      // End of input, there is nobody left to type quit.
+      break;
+    }
+    // Here-document bodies are read along with the line that opens them.
+    for (auto &&delimiter : hereDocumentDelimiters(cmd_line)) {
+      std::string body;
+      do {
+        if (!readLine("> ", body) || interrupted) {
+          break;
+        }
+        cmd_line += '\n';
+        cmd_line += body;
+      } while (body != delimiter);
+      if (interrupted) {
+        break;
+      }
+    }
+    if (!interrupted) {
+      smash.executeCommand(cmd_line.c_str());
+    }
   }
   return 0;
 }
\ No newline at end of file
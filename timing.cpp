@@ -0,0 +1,71 @@
+#include "timing.h"
+#include <algorithm>
+#include <stdio.h>
+
+static long long _micros(const struct timeval &time) {
+  return time.tv_sec * 1000000LL + time.tv_usec;
+}
+
+static void _addTime(struct timeval &total, const struct timeval &time) {
+  long long sum = _micros(total) + _micros(time);
+  total.tv_sec = sum / 1000000;
+  total.tv_usec = sum % 1000000;
+}
+
+void TimedUsage::add(const struct rusage &usage) {
+  _addTime(children.ru_utime, usage.ru_utime);
+  _addTime(children.ru_stime, usage.ru_stime);
+  children.ru_maxrss = std::max(children.ru_maxrss, usage.ru_maxrss);
+  children.ru_minflt += usage.ru_minflt;
+  children.ru_majflt += usage.ru_majflt;
+  children.ru_nvcsw += usage.ru_nvcsw;
+  children.ru_nivcsw += usage.ru_nivcsw;
+  processes++;
+}
+
+std::string formatTimes(uint64_t wallNanos, const TimedUsage &timed,
+                        const struct rusage &before, int status,
+                        bool verbose, bool json) {
+  struct rusage self;
+  getrusage(RUSAGE_SELF, &self);
+  long long user = _micros(timed.children.ru_utime) + _micros(self.ru_utime) -
+                   _micros(before.ru_utime);
+  long long sys = _micros(timed.children.ru_stime) + _micros(self.ru_stime) -
+                  _micros(before.ru_stime);
+  long minor = timed.children.ru_minflt + self.ru_minflt - before.ru_minflt;
+  long major = timed.children.ru_majflt + self.ru_majflt - before.ru_majflt;
+  long voluntary = timed.children.ru_nvcsw + self.ru_nvcsw - before.ru_nvcsw;
+  long involuntary =
+      timed.children.ru_nivcsw + self.ru_nivcsw - before.ru_nivcsw;
+  // A line that forked is as large as its largest process, a builtin is as
+  // large as the shell.
+  long maxRss =
+      timed.processes > 0 ? timed.children.ru_maxrss : self.ru_maxrss;
+
+  char text[512];
+  if (json) {
+    snprintf(text, sizeof(text),
+             "{\"real_ns\":%llu,\"user_us\":%lld,\"sys_us\":%lld,"
+             "\"max_rss_kb\":%ld,\"minor_faults\":%ld,\"major_faults\":%ld,"
+             "\"voluntary_switches\":%ld,\"involuntary_switches\":%ld,"
+             "\"processes\":%d,\"status\":%d}\n",
+             (unsigned long long)wallNanos, user, sys, maxRss, minor, major,
+             voluntary, involuntary, timed.processes, status);
+    return text;
+  }
+
+  snprintf(text, sizeof(text), "real %llu.%09llus\nuser %lld.%06llds\n"
+           "sys  %lld.%06llds\n",
+           (unsigned long long)wallNanos / 1000000000ULL,
+           (unsigned long long)wallNanos % 1000000000ULL, user / 1000000,
+           user % 1000000, sys / 1000000, sys % 1000000);
+  std::string report = text;
+  if (verbose) {
+    snprintf(text, sizeof(text),
+             "max rss %ld kB\npage faults %ld minor, %ld major\n"
+             "context switches %ld voluntary, %ld involuntary\n",
+             maxRss, minor, major, voluntary, involuntary);
+    report += text;
+  }
+  return report;
+}
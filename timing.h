@@ -0,0 +1,29 @@
+#ifndef SMASH_TIMING_H_
+#define SMASH_TIMING_H_
+
+#include <stdint.h>
+#include <string>
+#include <sys/resource.h>
+
+// What the processes of a timed line used, as wait4 reported it when they
+// were reaped.
+struct TimedUsage {
+  struct rusage children = {};
+  int processes = 0;
+
+  // Adds a reaped process. Times and counters are summed, the max RSS is
+  // the largest of any one process.
+  void add(const struct rusage &usage);
+};
+
+/**
+ * The report of the time prefix: the wall time, and the resources used by
+ * the timed processes plus what the shell itself used since before (the
+ * whole cost of a builtin). With verbose, also the max RSS, page faults and
+ * context switches. With json, all of it as one line of JSON.
+ */
+std::string formatTimes(uint64_t wallNanos, const TimedUsage &timed,
+                        const struct rusage &before, int status,
+                        bool verbose, bool json);
+
+#endif // SMASH_TIMING_H_
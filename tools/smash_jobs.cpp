@@ -0,0 +1,72 @@
+// Prints the jobs of a running smash from its shared memory job table,
+// without talking to the shell.
+//
+// usage: smash_jobs <shell pid> [-c count]
+// With -c the table is copied count times and the cost of a copy reported.
+#include "jobtable.h"
+#include <chrono>
+#include <errno.h>
+#include <iostream>
+#include <signal.h>
+#include <stdlib.h>
+#include <string>
+
+int main(int argc, char *argv[]) {
+  if (argc != 2 && !(argc == 4 && std::string(argv[2]) == "-c")) {
+    std::cerr << "usage: smash_jobs <shell pid> [-c count]" << std::endl;
+    return 1;
+  }
+  pid_t shell = atoi(argv[1]);
+  const JobTableData *table = jobTableAttach(shell);
+  if (!table) {
+    std::cerr << "smash_jobs: no job table for " << shell << std::endl;
+    return 1;
+  }
+  if (kill(shell, 0) == -1 && errno == ESRCH) {
+    std::cerr << "smash_jobs: warning: shell " << shell << " is gone"
+              << std::endl;
+  }
+
+  static JobTableSnapshot snapshot;
+  if (argc == 4) {
+    long count = atol(argv[3]);
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+      if (!jobTableSnapshot(table, &snapshot)) {
+        std::cerr << "smash_jobs: table kept changing" << std::endl;
+        return 1;
+      }
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << count << " snapshots, " << elapsed.count() / count
+              << " ns each" << '\n';
+    return 0;
+  }
+
+  if (!jobTableSnapshot(table, &snapshot)) {
+    std::cerr << "smash_jobs: table kept changing" << std::endl;
+    return 1;
+  }
+  time_t now = time(nullptr);
+  for (auto &&entry : snapshot.entries) {
+    if (entry.id == 0) {
+      continue;
+    }
+    std::cout << "[" << entry.id << "] " << entry.command << " : "
+              << entry.pid << " " << (long)(now - entry.start_time)
+              << " secs, " << entry.cpu_ms << " ms cpu"
+              << (entry.state == JOB_TABLE_STOPPED  ? " (stopped)"
+                  : entry.state == JOB_TABLE_KILLED ? " (killed)"
+                                                    : "")
+              << '\n';
+  }
+  std::cout << snapshot.count << " jobs";
+  if (snapshot.left_out > 0) {
+    std::cout << " shown, " << snapshot.left_out
+              << " more did not fit in the table";
+  }
+  std::cout << ", version " << snapshot.sequence / 2 << '\n';
+  jobTableDetach(table);
+  return 0;
+}
@@ -0,0 +1,217 @@
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_POINTER_LOCK_FREE == 2,
+              "signal handlers record events, they need lock-free atomics");
+
+struct TraceEvent {
+  // The event's index + 1 once it is fully written, 0 while it is written.
+  std::atomic<uint64_t> sequence;
+  uint64_t time;
+  uint64_t duration;
+  const char *category; // A literal, the same in forked children.
+  long arg;
+  pid_t pid;
+  char phase;
+  char name[TRACE_NAME_SIZE];
+  char detail[TRACE_DETAIL_SIZE];
+};
+
+struct TraceRing {
+  std::atomic<uint64_t> head;
+  uint64_t start;
+  pid_t shell;
+  int fd;
+  TraceEvent events[TRACE_RING_SIZE];
+};
+
+std::atomic<TraceRing *> traceRing(nullptr);
+// getpid() is a syscall, forked children refresh this instead.
+static pid_t tracePid = -1;
+
+static void _refreshPid() { tracePid = getpid(); }
+
+uint64_t traceClock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void _copyText(char *to, const char *from, size_t size) {
+  size_t i = 0;
+  for (; from && from[i] && i < size - 1; i++) {
+    to[i] = from[i];
+  }
+  to[i] = '\0';
+}
+
+static void _record(char phase, const char *category, const char *name,
+                    uint64_t time, uint64_t duration, long arg,
+                    const char *detail) {
+  TraceRing *ring = traceRing.load(std::memory_order_acquire);
+  if (!ring) {
+    return;
+  }
+
+  uint64_t index = ring->head.fetch_add(1, std::memory_order_relaxed);
+  TraceEvent &event = ring->events[index % TRACE_RING_SIZE];
+  event.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  event.time = time;
+  event.duration = duration;
+  event.category = category;
+  event.arg = arg;
+  event.pid = tracePid;
+  event.phase = phase;
+  _copyText(event.name, name, sizeof(event.name));
+  _copyText(event.detail, detail, sizeof(event.detail));
+  event.sequence.store(index + 1, std::memory_order_release);
+}
+
+void traceInstant(const char *category, const char *name, long arg,
+                  const char *detail) {
+  if (traceEnabled()) {
+    _record('i', category, name, traceClock(), 0, arg, detail);
+  }
+}
+
+void traceComplete(const char *category, const char *name, uint64_t start,
+                   long arg, const char *detail) {
+  if (traceEnabled()) {
+    _record('X', category, name, start, traceClock() - start, arg, detail);
+  }
+}
+
+bool traceStart(const std::string &path) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  // Shared, so the events forked children record end up here as well.
+  void *data = mmap(nullptr, sizeof(TraceRing), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  static bool registered = false;
+  if (!registered) {
+    pthread_atfork(nullptr, nullptr, _refreshPid);
+    registered = true;
+  }
+  _refreshPid();
+
+  auto ring = (TraceRing *)data;
+  ring->start = traceClock();
+  ring->shell = getpid();
+  ring->fd = fd;
+  traceRing.store(ring, std::memory_order_release);
+  return true;
+}
+
+static void _appendJson(std::string &out, const char *text) {
+  out += '"';
+  for (; *text; text++) {
+    unsigned char c = *text;
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+/**
+ * Formats the events still in the ring as Chrome trace JSON, which Perfetto
+ * and chrome://tracing open. Times are relative to the start of the trace.
+ */
+static std::string _formatEvents(TraceRing *ring, long &count) {
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" +
+         std::to_string(ring->shell) + ",\"args\":{\"name\":\"smash\"}}";
+
+  uint64_t head = ring->head.load(std::memory_order_acquire);
+  uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+  count = 0;
+  char number[64];
+  for (uint64_t index = first; index < head; index++) {
+    TraceEvent &event = ring->events[index % TRACE_RING_SIZE];
+    // Skips events a child was still writing.
+    if (event.sequence.load(std::memory_order_acquire) != index + 1) {
+      continue;
+    }
+
+    out += ",\n{\"name\":";
+    _appendJson(out, event.name);
+    out += ",\"cat\":";
+    _appendJson(out, event.category);
+    snprintf(number, sizeof(number), ",\"ph\":\"%c\",\"ts\":%.3f",
+             event.phase, (double)(event.time - ring->start) / 1000);
+    out += number;
+    if (event.phase == 'X') {
+      snprintf(number, sizeof(number), ",\"dur\":%.3f",
+               (double)event.duration / 1000);
+      out += number;
+    } else {
+      out += ",\"s\":\"t\"";
+    }
+    out += ",\"pid\":" + std::to_string(ring->shell) +
+           ",\"tid\":" + std::to_string(event.pid) +
+           ",\"args\":{\"arg\":" + std::to_string(event.arg);
+    if (event.detail[0]) {
+      out += ",\"detail\":";
+      _appendJson(out, event.detail);
+    }
+    out += "}}";
+    count++;
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+long traceStop() {
+  TraceRing *ring = traceRing.exchange(nullptr, std::memory_order_acq_rel);
+  if (!ring) {
+    return -1;
+  }
+
+  long count;
+  std::string out = _formatEvents(ring, count);
+  size_t written = 0;
+  while (written < out.size()) {
+    ssize_t res = write(ring->fd, out.data() + written, out.size() - written);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1) {
+      count = -1;
+      break;
+    }
+    written += res;
+  }
+  close(ring->fd);
+  munmap(ring, sizeof(TraceRing));
+  return count;
+}
+
+uint64_t traceDropped() {
+  TraceRing *ring = traceRing.load(std::memory_order_acquire);
+  if (!ring) {
+    return 0;
+  }
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  return head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+}
@@ -0,0 +1,67 @@
+#ifndef SMASH_TRACE_H_
+#define SMASH_TRACE_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#define TRACE_RING_SIZE (1 << 16)
+#define TRACE_NAME_SIZE (24)
+#define TRACE_DETAIL_SIZE (64)
+
+// Records what the shell spends its time on while a trace runs: parsing,
+// forks, execs, reaps, signals, job state changes and builtins. Events go
+// into a ring mapped shared before any fork, so forked children record into
+// it too, each under its own pid. When the ring is full the oldest events
+// are overwritten. Recording is lock-free and async-signal-safe, and with no
+// trace running it costs a single load.
+struct TraceRing;
+extern std::atomic<TraceRing *> traceRing;
+
+inline bool traceEnabled() {
+  return traceRing.load(std::memory_order_relaxed) != nullptr;
+}
+
+// CLOCK_MONOTONIC time in nanoseconds.
+uint64_t traceClock();
+// Starts recording, the events are written to path when the trace stops.
+bool traceStart(const std::string &path);
+// Writes the recorded events as Chrome trace JSON and stops recording.
+// Returns the number of events written, -1 if writing failed.
+long traceStop();
+// How many events were overwritten since the trace started.
+uint64_t traceDropped();
+
+// Records an event without a duration.
+void traceInstant(const char *category, const char *name, long arg,
+                  const char *detail = nullptr);
+// Records an event that ran from start until now.
+void traceComplete(const char *category, const char *name, uint64_t start,
+                   long arg, const char *detail = nullptr);
+
+// Records its lifetime as a complete event.
+class TraceScope {
+public:
+  TraceScope(const char *category, const char *name,
+             const char *detail = nullptr)
+      : category(category), name(name), detail(detail), arg(0),
+        start(traceEnabled() ? traceClock() : 0) {}
+  ~TraceScope() {
+    if (start != 0 && traceEnabled()) {
+      traceComplete(category, name, start, arg, detail);
+    }
+  }
+  TraceScope(TraceScope const &) = delete;      // disable copy ctor
+  void operator=(TraceScope const &) = delete; // disable = operator
+
+  void setArg(long value) { arg = value; }
+
+private:
+  const char *category;
+  const char *name;
+  const char *detail;
+  long arg;
+  uint64_t start;
+};
+
+#endif // SMASH_TRACE_H_